@@ -1,8 +1,20 @@
 #include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 /*
  *   Log Functions (printf wrappers)
@@ -57,69 +69,6 @@ void infof(const char *fmt, ...) {
  *   Types, Enums, and Definitions
  */
 
-// {{{ Opcodes
-
-typedef enum {
-	ADD,
-	ADDS,
-	SUB,
-	SUBS,
-	AND,
-	ANDS,
-	ORR,
-	EOR,
-	LSL,
-	LSR,
-	ASR,
-	MUL,
-	UMULH,
-	SMULH,
-	UDIV,
-	SDIV,
-	LDUR,
-	STUR,
-	LDURB,
-	STURB,
-	LDURH,
-	STURH,
-	LDURSW,
-	ADDI,
-	ADDIS,
-	SUBI,
-	SUBIS,
-	ANDI,
-	ORRI,
-	EORI,
-	MOVZ,
-	MOVK,
-	MOVN,
-	MOV,
-	CBZ,
-	CBNZ,
-	B,
-	BL,
-	BR,
-	CMP,
-	CMPI,
-	NOP,
-	RET,
-	SXTW,
-	SXTB,
-	SXTH,
-	UXTB,
-	UXTH,
-	UXTW,
-	B_EQ,
-	B_NE,
-	B_GT,
-	B_LT,
-	B_GE,
-	B_LE,
-	NUM_INSTRUCTIONS
-} Opcode;
-
-// }}}
-
 // {{{ Instruction Formats
 
 typedef enum {
@@ -132,54 +81,384 @@ typedef enum {
 	UNKNOWN_TYPE
 } InstructionFormat;
 
+// }}}
+
+// {{{ Opcodes
+
+// Functional unit that runs an instruction's EX stage
+typedef enum {
+	UNIT_ALU,
+	UNIT_MUL,
+	UNIT_DIV,
+	UNIT_MEM,
+	UNIT_BRANCH,
+	NUM_UNITS
+} FunctionalUnit;
+
+const char *unit_names[NUM_UNITS] = {
+	[UNIT_ALU] = "alu", [UNIT_MUL] = "mul",		  [UNIT_DIV] = "div",
+	[UNIT_MEM] = "mem", [UNIT_BRANCH] = "branch",
+};
+
+// Issue ports an N-wide pipeline limits per cycle
+typedef enum { PORT_ALU, PORT_MEM, PORT_BRANCH, NUM_PORTS } IssuePort;
+
+const char *port_names[NUM_PORTS] = {
+	[PORT_ALU] = "alu", [PORT_MEM] = "mem", [PORT_BRANCH] = "branch"};
+
+const uint8_t unit_ports[NUM_UNITS] = {
+	[UNIT_ALU] = PORT_ALU, [UNIT_MUL] = PORT_ALU,		  [UNIT_DIV] = PORT_ALU,
+	[UNIT_MEM] = PORT_MEM, [UNIT_BRANCH] = PORT_BRANCH,
+};
+
+// One row per opcode: enum name, mnemonic, format, functional unit and EX
+// latency in cycles. The enum, the tables below and the mnemonic lookup are
+// all generated from this list.
+#define OPCODE_TABLE(X)                           \
+	X(ADD,    "ADD",    R_TYPE,  UNIT_ALU,     1) \
+	X(ADDS,   "ADDS",   R_TYPE,  UNIT_ALU,     1) \
+	X(SUB,    "SUB",    R_TYPE,  UNIT_ALU,     1) \
+	X(SUBS,   "SUBS",   R_TYPE,  UNIT_ALU,     1) \
+	X(AND,    "AND",    R_TYPE,  UNIT_ALU,     1) \
+	X(ANDS,   "ANDS",   R_TYPE,  UNIT_ALU,     1) \
+	X(ORR,    "ORR",    R_TYPE,  UNIT_ALU,     1) \
+	X(EOR,    "EOR",    R_TYPE,  UNIT_ALU,     1) \
+	X(LSL,    "LSL",    R_TYPE,  UNIT_ALU,     1) \
+	X(LSR,    "LSR",    R_TYPE,  UNIT_ALU,     1) \
+	X(ASR,    "ASR",    R_TYPE,  UNIT_ALU,     1) \
+	X(MUL,    "MUL",    R_TYPE,  UNIT_MUL,     3) \
+	X(UMULH,  "UMULH",  R_TYPE,  UNIT_MUL,     3) \
+	X(SMULH,  "SMULH",  R_TYPE,  UNIT_MUL,     3) \
+	X(UDIV,   "UDIV",   R_TYPE,  UNIT_DIV,    12) \
+	X(SDIV,   "SDIV",   R_TYPE,  UNIT_DIV,    12) \
+	X(LDUR,   "LDUR",   D_TYPE,  UNIT_MEM,     1) \
+	X(STUR,   "STUR",   D_TYPE,  UNIT_MEM,     1) \
+	X(LDURB,  "LDURB",  D_TYPE,  UNIT_MEM,     1) \
+	X(STURB,  "STURB",  D_TYPE,  UNIT_MEM,     1) \
+	X(LDURH,  "LDURH",  D_TYPE,  UNIT_MEM,     1) \
+	X(STURH,  "STURH",  D_TYPE,  UNIT_MEM,     1) \
+	X(LDURSW, "LDURSW", D_TYPE,  UNIT_MEM,     1) \
+	X(ADDI,   "ADDI",   I_TYPE,  UNIT_ALU,     1) \
+	X(ADDIS,  "ADDIS",  I_TYPE,  UNIT_ALU,     1) \
+	X(SUBI,   "SUBI",   I_TYPE,  UNIT_ALU,     1) \
+	X(SUBIS,  "SUBIS",  I_TYPE,  UNIT_ALU,     1) \
+	X(ANDI,   "ANDI",   I_TYPE,  UNIT_ALU,     1) \
+	X(ORRI,   "ORRI",   I_TYPE,  UNIT_ALU,     1) \
+	X(EORI,   "EORI",   I_TYPE,  UNIT_ALU,     1) \
+	X(MOVZ,   "MOVZ",   IM_TYPE, UNIT_ALU,     1) \
+	X(MOVK,   "MOVK",   IM_TYPE, UNIT_ALU,     1) \
+	X(MOVN,   "MOVN",   IM_TYPE, UNIT_ALU,     1) \
+	X(MOV,    "MOV",    IM_TYPE, UNIT_ALU,     1) \
+	X(CBZ,    "CBZ",    CB_TYPE, UNIT_BRANCH,  1) \
+	X(CBNZ,   "CBNZ",   CB_TYPE, UNIT_BRANCH,  1) \
+	X(B,      "B",      B_TYPE,  UNIT_BRANCH,  1) \
+	X(BL,     "BL",     B_TYPE,  UNIT_BRANCH,  1) \
+	X(BR,     "BR",     B_TYPE,  UNIT_BRANCH,  1) \
+	X(CMP,    "CMP",    R_TYPE,  UNIT_ALU,     1) \
+	X(CMPI,   "CMPI",   I_TYPE,  UNIT_ALU,     1) \
+	X(NOP,    "NOP",    R_TYPE,  UNIT_ALU,     1) \
+	X(RET,    "RET",    R_TYPE,  UNIT_BRANCH,  1) \
+	X(SXTW,   "SXTW",   R_TYPE,  UNIT_ALU,     1) \
+	X(SXTB,   "SXTB",   R_TYPE,  UNIT_ALU,     1) \
+	X(SXTH,   "SXTH",   R_TYPE,  UNIT_ALU,     1) \
+	X(UXTB,   "UXTB",   R_TYPE,  UNIT_ALU,     1) \
+	X(UXTH,   "UXTH",   R_TYPE,  UNIT_ALU,     1) \
+	X(UXTW,   "UXTW",   R_TYPE,  UNIT_ALU,     1) \
+	X(B_EQ,   "B.EQ",   B_TYPE,  UNIT_BRANCH,  1) \
+	X(B_NE,   "B.NE",   B_TYPE,  UNIT_BRANCH,  1) \
+	X(B_GT,   "B.GT",   B_TYPE,  UNIT_BRANCH,  1) \
+	X(B_LT,   "B.LT",   B_TYPE,  UNIT_BRANCH,  1) \
+	X(B_GE,   "B.GE",   B_TYPE,  UNIT_BRANCH,  1) \
+	X(B_LE,   "B.LE",   B_TYPE,  UNIT_BRANCH,  1)
+
+#define OPCODE_ENUM(name, mnemonic, format, unit, latency) name,
+
+typedef enum { OPCODE_TABLE(OPCODE_ENUM) NUM_INSTRUCTIONS } Opcode;
+
+#undef OPCODE_ENUM
+
 // Array to get instruction format from opcode
+#define OPCODE_FORMAT(name, mnemonic, format, unit, latency) [name] = format,
 InstructionFormat instruction_formats[NUM_INSTRUCTIONS] = {
-	[ADD] = R_TYPE,	  [ADDS] = R_TYPE,	[SUB] = R_TYPE,	   [SUBS] = R_TYPE,
-	[AND] = R_TYPE,	  [ANDS] = R_TYPE,	[ORR] = R_TYPE,	   [EOR] = R_TYPE,
-	[LSL] = R_TYPE,	  [LSR] = R_TYPE,	[ASR] = R_TYPE,	   [MUL] = R_TYPE,
-	[UMULH] = R_TYPE, [SMULH] = R_TYPE, [UDIV] = R_TYPE,   [SDIV] = R_TYPE,
-	[LDUR] = D_TYPE,  [STUR] = D_TYPE,	[LDURB] = D_TYPE,  [STURB] = D_TYPE,
-	[LDURH] = D_TYPE, [STURH] = D_TYPE, [LDURSW] = D_TYPE, [ADDI] = I_TYPE,
-	[ADDIS] = I_TYPE, [SUBI] = I_TYPE,	[SUBIS] = I_TYPE,  [ANDI] = I_TYPE,
-	[ORRI] = I_TYPE,  [EORI] = I_TYPE,	[MOVZ] = IM_TYPE,  [MOVK] = IM_TYPE,
-	[MOVN] = IM_TYPE, [MOV] = IM_TYPE,	[CBZ] = CB_TYPE,   [CBNZ] = CB_TYPE,
-	[B] = B_TYPE,	  [BL] = B_TYPE,	[BR] = B_TYPE,	   [CMP] = R_TYPE,
-	[CMPI] = I_TYPE,  [NOP] = R_TYPE,	[RET] = R_TYPE,	   [SXTW] = R_TYPE,
-	[SXTB] = R_TYPE,  [SXTH] = R_TYPE,	[UXTB] = R_TYPE,   [UXTH] = R_TYPE,
-	[UXTW] = R_TYPE,  [B_EQ] = B_TYPE,	[B_NE] = B_TYPE,   [B_GT] = B_TYPE,
-	[B_LT] = B_TYPE,  [B_GE] = B_TYPE,	[B_LE] = B_TYPE,
+	OPCODE_TABLE(OPCODE_FORMAT)};
+#undef OPCODE_FORMAT
+
+// Array to get mnemonic from opcode
+#define OPCODE_MNEMONIC(name, mnemonic, format, unit, latency) [name] = mnemonic,
+const char *instruction_mnemonics[NUM_INSTRUCTIONS] = {
+	OPCODE_TABLE(OPCODE_MNEMONIC)};
+#undef OPCODE_MNEMONIC
+
+// Default unit and EX latency of each opcode
+#define OPCODE_UNIT(name, mnemonic, format, unit, latency) [name] = unit,
+const uint8_t instruction_units[NUM_INSTRUCTIONS] = {
+	OPCODE_TABLE(OPCODE_UNIT)};
+#undef OPCODE_UNIT
+
+#define OPCODE_LATENCY(name, mnemonic, format, unit, latency) [name] = latency,
+const uint8_t instruction_latencies[NUM_INSTRUCTIONS] = {
+	OPCODE_TABLE(OPCODE_LATENCY)};
+#undef OPCODE_LATENCY
+
+// }}}
+
+// {{{ Registers
+
+// Registers are interned to their number at parse time. XZR is never a real
+// dependency, so bit 31 of the read/write masks is reused for the NZCV flags.
+typedef uint8_t Register;
+
+#define REG_IP0 16
+#define REG_IP1 17
+#define REG_SP 28
+#define REG_FP 29
+#define REG_LR 30
+#define REG_XZR 31
+#define NUM_REGISTERS 32
+#define REG_NONE 0xFF
+
+#define REG_FLAGS_BIT (1u << 31)
+
+const char *register_names[NUM_REGISTERS] = {
+	"X0",  "X1",  "X2",  "X3",	"X4",  "X5",  "X6",	 "X7",
+	"X8",  "X9",  "X10", "X11", "X12", "X13", "X14", "X15",
+	"X16", "X17", "X18", "X19", "X20", "X21", "X22", "X23",
+	"X24", "X25", "X26", "X27", "SP",  "FP",  "LR",	 "XZR",
 };
 
+static const char *registerName(Register r) {
+	return r < NUM_REGISTERS ? register_names[r] : "(none)";
+}
+
 // }}}
 
 // {{{ Values For Different Formats
 
 typedef struct {
-	char *rd, *rn, *rm, *shamt;
+	Register rd, rn, rm;
+	char *shamt;
 } RVals;
 typedef struct {
-	char *rd, *rn, *imm12;
+	Register rd, rn;
+	char *imm12;
 } IVals;
 typedef struct {
-	char *rt, *rn, *addr9;
+	Register rt, rn;
+	char *addr9;
 } DVals;
 typedef struct {
+	Register rn;
 	char *imm26;
 } BVals;
 typedef struct {
-	char *rt, *imm19;
+	Register rt;
+	char *imm19;
 } CBVals;
 typedef struct {
-	char *rd, *imm16, *sh;
+	Register rd, rn;
+	char *imm16, *sh;
 } IMVals;
 
 // }}}
 
+// {{{ Arena Allocator
+
+// Bump allocator that owns everything parsed for one program (instructions
+// and operand text). Loading a new program resets it instead of freeing
+// every string, so memory stays flat across many programs.
+typedef struct ArenaBlock {
+	struct ArenaBlock *next;
+	size_t size, used;
+	unsigned char data[];
+} ArenaBlock;
+
+typedef struct {
+	ArenaBlock *head;
+} Arena;
+
+#define ARENA_MIN_BLOCK (64 * 1024)
+#define ARENA_ALIGN 16
+
+static ArenaBlock *arenaNewBlock(size_t size, ArenaBlock *next) {
+	ArenaBlock *block = malloc(sizeof(ArenaBlock) + size);
+
+	if (block == NULL) {
+		errorf("Out of memory\n");
+		exit(1);
+	}
+	block->next = next;
+	block->size = size;
+	block->used = 0;
+	return block;
+}
+
+void *arenaAlloc(Arena *arena, size_t size) {
+	ArenaBlock *block = arena->head;
+
+	if (block != NULL) {
+		uintptr_t base = (uintptr_t)block->data;
+		uintptr_t next = (base + block->used + ARENA_ALIGN - 1) &
+						 ~(uintptr_t)(ARENA_ALIGN - 1);
+		size_t offset = (size_t)(next - base);
+
+		if (offset + size <= block->size) {
+			block->used = offset + size;
+			return block->data + offset;
+		}
+	}
+
+	size_t want = size + ARENA_ALIGN;
+	size_t grow = block != NULL ? block->size * 2 : ARENA_MIN_BLOCK;
+	arena->head = arenaNewBlock(want > grow ? want : grow, block);
+
+	return arenaAlloc(arena, size);
+}
+
+char *arenaStrndup(Arena *arena, const char *s, size_t len) {
+	char *copy = arenaAlloc(arena, len + 1);
+
+	memcpy(copy, s, len);
+	copy[len] = '\0';
+	return copy;
+}
+
+// Makes sure the next `size` bytes come from a single block
+void arenaReserve(Arena *arena, size_t size) {
+	ArenaBlock *block = arena->head;
+
+	if (block == NULL || block->size - block->used < size + ARENA_ALIGN)
+		arena->head = arenaNewBlock(size + ARENA_ALIGN, block);
+}
+
+// Drops everything allocated so far. A chain of blocks is merged into one
+// so the next program of the same size fits in a single allocation.
+void arenaReset(Arena *arena) {
+	ArenaBlock *block = arena->head;
+
+	if (block == NULL)
+		return;
+
+	if (block->next != NULL) {
+		size_t total = 0;
+
+		while (block != NULL) {
+			ArenaBlock *next = block->next;
+			total += block->size;
+			free(block);
+			block = next;
+		}
+		arena->head = arenaNewBlock(total, NULL);
+		return;
+	}
+
+	block->used = 0;
+}
+
+void arenaFree(Arena *arena) {
+	ArenaBlock *block = arena->head;
+
+	while (block != NULL) {
+		ArenaBlock *next = block->next;
+		free(block);
+		block = next;
+	}
+	arena->head = NULL;
+}
+
+// }}}
+
+// {{{ Symbol Table
+
+// Labels of one program, hashed with FNV-1a into an open-addressing table.
+// Names and slots live in the program arena.
+typedef struct {
+	const char *name;
+	uint32_t length;
+	uint32_t hash;
+	int32_t index;
+} Symbol;
+
+typedef struct {
+	Symbol *slots;
+	uint32_t capacity, count;
+} SymbolTable;
+
+static uint32_t symbolHash(const char *name, size_t length) {
+	uint32_t hash = 2166136261u;
+
+	for (size_t i = 0; i < length; i++) {
+		hash ^= (unsigned char)name[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static Symbol *symbolSlot(const SymbolTable *table, const char *name,
+						  size_t length, uint32_t hash) {
+	uint32_t mask = table->capacity - 1;
+
+	for (uint32_t i = hash & mask;; i = (i + 1) & mask) {
+		Symbol *slot = &table->slots[i];
+
+		if (slot->name == NULL ||
+			(slot->hash == hash && slot->length == length &&
+			 memcmp(slot->name, name, length) == 0))
+			return slot;
+	}
+}
+
+// Returns -1 if the symbol already exists
+int symbolDefine(SymbolTable *table, Arena *arena, const char *name,
+				 size_t length, int32_t index) {
+	uint32_t hash = symbolHash(name, length);
+
+	if (2 * (table->count + 1) > table->capacity) {
+		SymbolTable grown = {0};
+
+		grown.capacity = table->capacity ? table->capacity * 2 : 64;
+		grown.slots = arenaAlloc(arena, grown.capacity * sizeof(Symbol));
+		memset(grown.slots, 0, grown.capacity * sizeof(Symbol));
+
+		for (uint32_t i = 0; i < table->capacity; i++) {
+			Symbol *old = &table->slots[i];
+			if (old->name != NULL)
+				*symbolSlot(&grown, old->name, old->length, old->hash) = *old;
+		}
+		grown.count = table->count;
+		*table = grown;
+	}
+
+	Symbol *slot = symbolSlot(table, name, length, hash);
+	if (slot->name != NULL)
+		return -1;
+
+	slot->name = arenaStrndup(arena, name, length);
+	slot->length = (uint32_t)length;
+	slot->hash = hash;
+	slot->index = index;
+	table->count++;
+	return 0;
+}
+
+// Instruction index of a label, -1 if it is not defined
+int32_t symbolLookup(const SymbolTable *table, const char *name,
+					 size_t length) {
+	if (table->count == 0)
+		return -1;
+
+	Symbol *slot = symbolSlot(table, name, length, symbolHash(name, length));
+	return slot->name != NULL ? slot->index : -1;
+}
+
+// }}}
+
 // {{{ Parsed Instruction Structs
 
 typedef struct {
 	Opcode type;
 	InstructionFormat format;
+	uint32_t read_mask, write_mask;
+	int32_t target;
 	union {
 		RVals R;
 		IVals I;
@@ -193,6 +472,8 @@ typedef struct {
 typedef struct {
 	int instructions_count;
 	Instruction *instructions;
+	SymbolTable symbols;
+	Arena arena;
 } Inputs;
 
 // }}}
@@ -201,477 +482,5929 @@ typedef struct {
  *   Parser, Helper Functions
  */
 
-// {{{ Helper Functions
+// {{{ Lexer
 
-static void skip_spaces(const char *s, size_t *i) {
-	while (s[*i] == ' ' || s[*i] == '\t')
-		(*i)++;
-}
+// A token is a span of the source line. Nothing is copied until an operand
+// has to outlive the line.
+typedef struct {
+	const char *start;
+	uint32_t length;
+} Token;
 
-static char *parse_token(const char *s, size_t *i, const char *stoppers) {
-	char buf[32];
-	size_t u = 0;
+#define MAX_LINE_TOKENS 8
 
-	skip_spaces(s, i);
+// Bytes that end a token: whitespace and control characters, `,`, `[`, `]`,
+// `#` and `:`. Scanners set bit k when s[k] is one, 32 bytes at a time.
+static uint8_t delimiter_table[256];
 
-	while (s[*i] != '\0' && strchr(stoppers, s[*i]) == NULL &&
-		   u < sizeof(buf) - 1) {
-		buf[u++] = s[*i];
-		(*i)++;
-	}
+static uint32_t scanDelimitersScalar(const char *s) {
+	uint32_t mask = 0;
 
-	buf[u] = '\0';
-	return strdup(buf);
+	for (int k = 0; k < 32; k++)
+		mask |= (uint32_t)delimiter_table[(unsigned char)s[k]] << k;
+	return mask;
 }
 
-static void skip_comma_and_spaces(const char *s, size_t *i) {
-	skip_spaces(s, i);
-	if (s[*i] == ',')
-		(*i)++;
-	skip_spaces(s, i);
-}
+#if defined(__SSE2__)
+static inline uint32_t scanDelimiters16(__m128i bytes) {
+	__m128i control = _mm_cmpeq_epi8(_mm_min_epu8(bytes, _mm_set1_epi8(' ')),
+									 bytes);
+	__m128i punctuation =
+		_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(',')),
+								  _mm_cmpeq_epi8(bytes, _mm_set1_epi8('#'))),
+					 _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('[')),
+								  _mm_cmpeq_epi8(bytes, _mm_set1_epi8(']'))));
+	__m128i label = _mm_cmpeq_epi8(bytes, _mm_set1_epi8(':'));
 
-int isLoad(Instruction ins) {
-	return ins.type == LDUR || ins.type == LDURB || ins.type == LDURH ||
-		   ins.type == LDURSW;
+	return (uint32_t)_mm_movemask_epi8(
+		_mm_or_si128(control, _mm_or_si128(punctuation, label)));
 }
 
-int instructionReadsRegister(Instruction ins, const char *reg) {
-
-	switch (ins.format) {
-
-	case R_TYPE:
-		return (ins.values.R.rn && strcmp(ins.values.R.rn, reg) == 0) ||
-			   (ins.values.R.rm && strcmp(ins.values.R.rm, reg) == 0);
-
-	case I_TYPE:
-		return (ins.values.I.rn && strcmp(ins.values.I.rn, reg) == 0);
-
-	case D_TYPE:
-		if (ins.type == STUR || ins.type == STURH || ins.type == STURB) {
-			return (ins.values.D.rn && strcmp(ins.values.D.rn, reg) == 0) ||
-				   (ins.values.D.rt && strcmp(ins.values.D.rt, reg) == 0);
-		}
-		return 0;
-
-	case CB_TYPE:
-		return (ins.values.CB.rt && strcmp(ins.values.CB.rt, reg) == 0);
-
-	case B_TYPE:
-		return 0;
-
-	default:
-		return 0;
-	}
+static uint32_t scanDelimitersSSE2(const char *s) {
+	return scanDelimiters16(_mm_loadu_si128((const __m128i *)s)) |
+		   scanDelimiters16(_mm_loadu_si128((const __m128i *)(s + 16))) << 16;
 }
+#endif
 
-// }}}
-
-// {{{ Parse Instruction Values
-
-void parseInstructionValues(Instruction *instruction, const char *line) {
-	size_t i = 0;
-
-	skip_spaces(line, &i);
-	while (line[i] != '\0' && !isspace((unsigned char)line[i]))
-		i++;
-	if (instruction->format == R_TYPE) {
-		instruction->values.R.rd = parse_token(line, &i, ", \t\n");
-		skip_comma_and_spaces(line, &i);
-
-		instruction->values.R.rn = parse_token(line, &i, ", \t\n");
-		skip_comma_and_spaces(line, &i);
-
-		instruction->values.R.rm = parse_token(line, &i, ", \t\n");
-
-		instruction->values.R.shamt = NULL;
-	} else if (instruction->format == I_TYPE) {
-		instruction->values.I.rd = parse_token(line, &i, ", \t\n");
-		skip_comma_and_spaces(line, &i);
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+__attribute__((target("avx2"))) static uint32_t
+scanDelimitersAVX2(const char *s) {
+	__m256i bytes = _mm256_loadu_si256((const __m256i *)s);
+	__m256i control = _mm256_cmpeq_epi8(
+		_mm256_min_epu8(bytes, _mm256_set1_epi8(' ')), bytes);
+	__m256i punctuation = _mm256_or_si256(
+		_mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(',')),
+						_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('#'))),
+		_mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('[')),
+						_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(']'))));
+	__m256i label = _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(':'));
 
-		instruction->values.I.rn = parse_token(line, &i, ", \t\n");
-		skip_comma_and_spaces(line, &i);
+	return (uint32_t)_mm256_movemask_epi8(
+		_mm256_or_si256(control, _mm256_or_si256(punctuation, label)));
+}
+#endif
 
-		skip_spaces(line, &i);
-		if (line[i] == '#')
-			i++;
-		instruction->values.I.imm12 = parse_token(line, &i, " \t\n");
-	} else if (instruction->format == D_TYPE) {
-		instruction->values.D.rt = parse_token(line, &i, ", \t\n");
-		skip_comma_and_spaces(line, &i);
+static uint32_t (*scanDelimiters)(const char *s) = scanDelimitersScalar;
 
-		skip_spaces(line, &i);
-		if (line[i] == '[')
-			i++;
+// Picks the widest scanner the CPU supports
+void initLexer(void) {
+	for (int c = 0; c <= ' '; c++)
+		delimiter_table[c] = 1;
+	delimiter_table[','] = delimiter_table['#'] = 1;
+	delimiter_table['['] = delimiter_table[']'] = 1;
+	delimiter_table[':'] = 1;
 
-		instruction->values.D.rn = parse_token(line, &i, ", ]\t\n");
-		skip_comma_and_spaces(line, &i);
+#if defined(__SSE2__)
+	scanDelimiters = scanDelimitersSSE2;
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	if (__builtin_cpu_supports("avx2"))
+		scanDelimiters = scanDelimitersAVX2;
+#endif
+}
 
-		skip_spaces(line, &i);
-		if (line[i] == '#')
-			i++;
-		instruction->values.D.addr9 = parse_token(line, &i, "] \t\n");
+// Splits the `length` bytes at s into at most `max` tokens. `readable` is how
+// many bytes from s may be loaded, so whole blocks are scanned in place and
+// only the end of the buffer is copied out.
+int lexLine(const char *s, size_t length, size_t readable, Token *tokens,
+			int max) {
+	char padded[32];
+	size_t start = 0;
+	int count = 0;
+	int open = 0;
 
-		skip_spaces(line, &i);
-		if (line[i] == ']')
-			i++;
-	} else if (instruction->format == B_TYPE) {
-		skip_spaces(line, &i);
-		instruction->values.B.imm26 = parse_token(line, &i, " \t\n");
-	} else if (instruction->format == CB_TYPE) {
-		instruction->values.CB.rt = parse_token(line, &i, ", \t\n");
-		skip_comma_and_spaces(line, &i);
+	for (size_t base = 0; base < length && count < max; base += 32) {
+		const char *block = s + base;
+		size_t left = length - base;
 
-		instruction->values.CB.imm19 = parse_token(line, &i, " \t\n");
-	} else if (instruction->format == IM_TYPE) {
-		instruction->values.IM.rd = parse_token(line, &i, ", \t\n");
-		skip_comma_and_spaces(line, &i);
+		if (readable - base < 32) {
+			memset(padded, ' ', sizeof padded);
+			memcpy(padded, block, left < 32 ? left : 32);
+			block = padded;
+		}
 
-		skip_spaces(line, &i);
-		if (line[i] == '#')
-			i++;
-		instruction->values.IM.imm16 = parse_token(line, &i, ", \t\n");
+		uint32_t delimiters = scanDelimiters(block);
+		if (left < 32)
+			delimiters |= ~0u << left;
 
-		skip_comma_and_spaces(line, &i);
+		// Alternate between the next token start and the delimiter ending it
+		for (uint32_t from = ~0u; count < max;) {
+			uint32_t candidates = (open ? delimiters : ~delimiters) & from;
+			if (candidates == 0)
+				break;
 
-		instruction->values.IM.sh = NULL;
-		if (line[i] != '\0') {
-			if (line[i] == 'L') {
-				while (line[i] != '\0' && !isspace((unsigned char)line[i]))
-					i++;
-			}
-			skip_spaces(line, &i);
-			if (line[i] == '#')
-				i++;
-			instruction->values.IM.sh = parse_token(line, &i, " \t\n");
+			unsigned k = (unsigned)__builtin_ctz(candidates);
+			if (open)
+				tokens[count++] =
+					(Token){s + start, (uint32_t)(base + k - start)};
+			else
+				start = base + k;
+			open = !open;
+			from = k < 31 ? ~0u << (k + 1) : 0;
 		}
 	}
+
+	if (open && count < max)
+		tokens[count++] = (Token){s + start, (uint32_t)(length - start)};
+	return count;
 }
 
 // }}}
 
-// {{{ Instruction Parser
+// {{{ Helper Functions
 
-Instruction parseInstructionFromUser(char *instruction_unparsed) {
-	Instruction instruction;
+static Register parseRegisterName(const char *s, size_t len) {
+	char c0 = len > 0 ? (char)toupper((unsigned char)s[0]) : '\0';
+	char c1 = len > 1 ? (char)toupper((unsigned char)s[1]) : '\0';
+	char c2 = len > 2 ? (char)toupper((unsigned char)s[2]) : '\0';
 
-	char instruction_str[16];
-	size_t i = 0;
+	if (c0 == 'X' && len == 3 && c1 == 'Z' && c2 == 'R')
+		return REG_XZR;
 
-	while (instruction_unparsed[i] != '\0' && instruction_unparsed[i] != ' ' &&
-		   i < sizeof instruction_str - 1) {
-		instruction_str[i] = instruction_unparsed[i];
-		i++;
+	if (c0 == 'X' && len >= 2 && len <= 3 && isdigit((unsigned char)c1) &&
+		(len == 2 || isdigit((unsigned char)c2))) {
+		int n = c1 - '0';
+		if (len == 3)
+			n = n * 10 + (c2 - '0');
+		return n < NUM_REGISTERS ? (Register)n : REG_NONE;
 	}
-	instruction_str[i] = '\0';
 
-	if (strcmp(instruction_str, "ADD") == 0) {
-		instruction.type = ADD;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "ADDS") == 0) {
-		instruction.type = ADDS;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "SUB") == 0) {
-		instruction.type = SUB;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "SUBS") == 0) {
-		instruction.type = SUBS;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "AND") == 0) {
-		instruction.type = AND;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "ANDS") == 0) {
-		instruction.type = ANDS;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "ORR") == 0) {
-		instruction.type = ORR;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "EOR") == 0) {
-		instruction.type = EOR;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "LSL") == 0) {
-		instruction.type = LSL;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "LSR") == 0) {
-		instruction.type = LSR;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "ASR") == 0) {
-		instruction.type = ASR;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "MUL") == 0) {
-		instruction.type = MUL;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "UMULH") == 0) {
-		instruction.type = UMULH;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "SMULH") == 0) {
-		instruction.type = SMULH;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "UDIV") == 0) {
-		instruction.type = UDIV;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "SDIV") == 0) {
-		instruction.type = SDIV;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "LDUR") == 0) {
-		instruction.type = LDUR;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "STUR") == 0) {
-		instruction.type = STUR;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "LDURB") == 0) {
-		instruction.type = LDURB;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "STURB") == 0) {
-		instruction.type = STURB;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "LDURH") == 0) {
-		instruction.type = LDURH;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "STURH") == 0) {
-		instruction.type = STURH;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "LDURSW") == 0) {
-		instruction.type = LDURSW;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "ADDI") == 0) {
-		instruction.type = ADDI;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "ADDIS") == 0) {
-		instruction.type = ADDIS;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "SUBI") == 0) {
-		instruction.type = SUBI;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "SUBIS") == 0) {
-		instruction.type = SUBIS;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "ANDI") == 0) {
-		instruction.type = ANDI;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "ORRI") == 0) {
-		instruction.type = ORRI;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "EORI") == 0) {
-		instruction.type = EORI;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "MOVZ") == 0) {
-		instruction.type = MOVZ;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "MOVK") == 0) {
-		instruction.type = MOVK;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "MOVN") == 0) {
-		instruction.type = MOVN;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "MOV") == 0) {
-		instruction.type = MOV;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "CBZ") == 0) {
-		instruction.type = CBZ;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "CBNZ") == 0) {
-		instruction.type = CBNZ;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "B") == 0) {
-		instruction.type = B;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "BL") == 0) {
-		instruction.type = BL;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "BR") == 0) {
-		instruction.type = BR;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "CMP") == 0) {
-		instruction.type = CMP;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "CMPI") == 0) {
-		instruction.type = CMPI;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "NOP") == 0) {
-		instruction.type = NOP;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "RET") == 0) {
-		instruction.type = RET;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "SXTW") == 0) {
-		instruction.type = SXTW;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "SXTB") == 0) {
-		instruction.type = SXTB;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "SXTH") == 0) {
-		instruction.type = SXTH;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "UXTB") == 0) {
-		instruction.type = UXTB;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "UXTH") == 0) {
-		instruction.type = UXTH;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "UXTW") == 0) {
-		instruction.type = UXTW;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "B.EQ") == 0) {
-		instruction.type = B_EQ;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "B.NE") == 0) {
-		instruction.type = B_NE;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "B.GT") == 0) {
-		instruction.type = B_GT;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "B.LT") == 0) {
-		instruction.type = B_LT;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "B.GE") == 0) {
-		instruction.type = B_GE;
-		instruction.format = instruction_formats[instruction.type];
-	} else if (strcmp(instruction_str, "B.LE") == 0) {
-		instruction.type = B_LE;
-		instruction.format = instruction_formats[instruction.type];
-	} else {
-		instruction.type = NUM_INSTRUCTIONS;
-		instruction.format = UNKNOWN_TYPE;
-		errorf("Unknown instruction - %s\n", instruction_str);
-	}
+	if (len == 2 && c0 == 'S' && c1 == 'P')
+		return REG_SP;
+	if (len == 2 && c0 == 'F' && c1 == 'P')
+		return REG_FP;
+	if (len == 2 && c0 == 'L' && c1 == 'R')
+		return REG_LR;
+	if (len == 3 && c0 == 'I' && c1 == 'P' && (c2 == '0' || c2 == '1'))
+		return c2 == '0' ? REG_IP0 : REG_IP1;
 
-	parseInstructionValues(&instruction, instruction_unparsed);
+	return REG_NONE;
+}
 
-	return instruction;
+static inline uint32_t registerBit(Register r) {
+	return r < REG_XZR ? 1u << r : 0;
 }
 
-// }}}
+int isLoad(Instruction ins) {
+	return ins.type == LDUR || ins.type == LDURB || ins.type == LDURH ||
+		   ins.type == LDURSW;
+}
 
-/*
- *  Input and Output
- */
+int isStore(Instruction ins) {
+	return ins.type == STUR || ins.type == STURB || ins.type == STURH;
+}
 
-// {{{ Log Parsed Instruction
+int setsFlags(Instruction ins) {
+	return ins.type == ADDS || ins.type == SUBS || ins.type == ANDS ||
+		   ins.type == ADDIS || ins.type == SUBIS || ins.type == CMP ||
+		   ins.type == CMPI;
+}
 
-void printInstruction(const Instruction *ins) {
-	if (ins->type != NUM_INSTRUCTIONS)
-		infof("\033[1mOpcode\033[0m = %d\n", ins->type);
+int readsFlags(Instruction ins) {
+	return ins.type == B_EQ || ins.type == B_NE || ins.type == B_GT ||
+		   ins.type == B_LT || ins.type == B_GE || ins.type == B_LE;
+}
+
+int isBranch(Instruction ins) {
+	return ins.format == B_TYPE || ins.format == CB_TYPE || ins.type == RET;
+}
+
+int isConditionalBranch(Instruction ins) {
+	return ins.format == CB_TYPE || readsFlags(ins);
+}
+
+// Precomputes the def/use sets so a hazard check is a single AND
+void computeRegisterMasks(Instruction *ins) {
+	uint32_t reads = 0, writes = 0;
 
 	switch (ins->format) {
 
 	case R_TYPE:
-		infof("\033[1mFormat\033[0m = R_TYPE\n");
-		infof("\033[1mrd\033[0m = %s\n", ins->values.R.rd);
-		infof("\033[1mrn\033[0m = %s\n", ins->values.R.rn);
-		infof("\033[1mrm\033[0m = %s\n", ins->values.R.rm);
-		infof("\033[1mshamt\033[0m = %s\n", ins->values.R.shamt);
+		reads = registerBit(ins->values.R.rn) | registerBit(ins->values.R.rm);
+		writes = registerBit(ins->values.R.rd);
 		break;
 
 	case I_TYPE:
-		infof("\033[1mFormat\033[0m = I_TYPE\n");
-		infof("\033[1mrd\033[0m = %s\n", ins->values.I.rd);
-		infof("\033[1mrn\033[0m = %s\n", ins->values.I.rn);
-		infof("\033[1mimm12\033[0m = %s\n", ins->values.I.imm12);
+		reads = registerBit(ins->values.I.rn);
+		writes = registerBit(ins->values.I.rd);
 		break;
 
 	case D_TYPE:
-		infof("\033[1mFormat\033[0m = D_TYPE\n");
-		infof("\033[1mrt\033[0m = %s\n", ins->values.D.rt);
-		infof("\033[1mrn\033[0m = %s\n", ins->values.D.rn);
-		infof("\033[1maddr9\033[0m = %s\n", ins->values.D.addr9);
+		reads = registerBit(ins->values.D.rn);
+		if (isStore(*ins))
+			reads |= registerBit(ins->values.D.rt);
+		else
+			writes = registerBit(ins->values.D.rt);
 		break;
 
 	case B_TYPE:
-		infof("\033[1mFormat\033[0m = B_TYPE\n");
-		infof("\033[1mimm26\033[0m = %s\n", ins->values.B.imm26);
+		reads = registerBit(ins->values.B.rn);
+		if (ins->type == BL)
+			writes = registerBit(REG_LR);
 		break;
 
 	case CB_TYPE:
-		infof("\033[1mFormat\033[0m = CB_TYPE\n");
-		infof("\033[1mrt\033[0m = %s\n", ins->values.CB.rt);
-		infof("\033[1mimm19\033[0m = %s\n", ins->values.CB.imm19);
+		reads = registerBit(ins->values.CB.rt);
 		break;
 
 	case IM_TYPE:
-		infof("\033[1mFormat\033[0m = IM_TYPE\n");
-		infof("\033[1mrd\033[0m = %s\n", ins->values.IM.rd);
-		infof("\033[1mimm16\033[0m = %s\n", ins->values.IM.imm16);
-		infof("\033[1msh\033[0m = %s\n", ins->values.IM.sh);
+		reads = registerBit(ins->values.IM.rn);
+		if (ins->type == MOVK)
+			reads |= registerBit(ins->values.IM.rd);
+		writes = registerBit(ins->values.IM.rd);
 		break;
 
 	default:
-		errorf("Unknown Format\n");
 		break;
 	}
+
+	if (setsFlags(*ins))
+		writes |= REG_FLAGS_BIT;
+	if (readsFlags(*ins))
+		reads |= REG_FLAGS_BIT;
+
+	ins->read_mask = reads;
+	ins->write_mask = writes;
 }
 
 // }}}
 
-// {{{ Get Inputs
+// {{{ Parse Instruction Values
+
+static Register tokenRegister(Token token) {
+	return parseRegisterName(token.start, token.length);
+}
+
+static char *tokenText(Token token, Arena *arena) {
+	return token.length != 0 ? arenaStrndup(arena, token.start, token.length)
+							 : NULL;
+}
+
+// `#` is a delimiter, so an immediate is whatever starts like a number
+static int tokenIsImmediate(Token token) {
+	return token.length != 0 &&
+		   (token.start[0] == '-' || isdigit((unsigned char)token.start[0]));
+}
+
+// Operands are tokens 1 and up of a line padded with empty tokens to
+// MAX_LINE_TOKENS, so a missing operand reads as no register or no text
+void parseInstructionValues(Instruction *instruction, const Token *t,
+							 Arena *arena) {
+	if (instruction->format == R_TYPE) {
+		RVals *r = &instruction->values.R;
+		int next = 2;
+
+		*r = (RVals){REG_NONE, REG_NONE, REG_NONE, NULL};
+
+		if (instruction->type == NOP)
+			return;
+
+		if (instruction->type == RET) {
+			r->rn = t[1].length != 0 ? tokenRegister(t[1]) : REG_LR;
+			return;
+		}
+
+		if (instruction->type == CMP) {
+			r->rd = REG_XZR;
+			next = 1;
+		} else {
+			r->rd = tokenRegister(t[1]);
+		}
+
+		r->rn = tokenRegister(t[next]);
+		if (tokenIsImmediate(t[next + 1]))
+			r->shamt = tokenText(t[next + 1], arena);
+		else
+			r->rm = tokenRegister(t[next + 1]);
+	} else if (instruction->format == I_TYPE) {
+		IVals *i = &instruction->values.I;
+		int next = 2;
+
+		if (instruction->type == CMPI) {
+			i->rd = REG_XZR;
+			next = 1;
+		} else {
+			i->rd = tokenRegister(t[1]);
+		}
+
+		i->rn = tokenRegister(t[next]);
+		i->imm12 = tokenText(t[next + 1], arena);
+	} else if (instruction->format == D_TYPE) {
+		instruction->values.D = (DVals){tokenRegister(t[1]), tokenRegister(t[2]),
+										tokenText(t[3], arena)};
+	} else if (instruction->format == B_TYPE) {
+		instruction->values.B = (BVals){REG_NONE, NULL};
+
+		if (instruction->type == BR)
+			instruction->values.B.rn = tokenRegister(t[1]);
+		else
+			instruction->values.B.imm26 = tokenText(t[1], arena);
+	} else if (instruction->format == CB_TYPE) {
+		instruction->values.CB =
+			(CBVals){tokenRegister(t[1]), tokenText(t[2], arena)};
+	} else if (instruction->format == IM_TYPE) {
+		IMVals *im = &instruction->values.IM;
+		int next = 3;
+
+		*im = (IMVals){tokenRegister(t[1]), REG_NONE, NULL, NULL};
+
+		if (tokenIsImmediate(t[2]))
+			im->imm16 = tokenText(t[2], arena);
+		else
+			im->rn = tokenRegister(t[2]);
+
+		// The shift may be written `LSL #16` or just `16`
+		if (t[next].length != 0 && !tokenIsImmediate(t[next]))
+			next++;
+		im->sh = tokenText(t[next], arena);
+	}
+}
+
+// }}}
+
+// {{{ Opcode Lookup
+
+// Perfect hash over the mnemonics packed into a 64-bit integer. The multiplier
+// is searched once at startup so every row of OPCODE_TABLE lands in its own
+// slot, and a lookup is always one multiply, one shift and one compare.
+#define OPCODE_HASH_BITS 8
+#define OPCODE_HASH_SIZE (1 << OPCODE_HASH_BITS)
+
+static uint64_t opcode_hash_multiplier;
+static uint64_t opcode_hash_keys[OPCODE_HASH_SIZE];
+static uint8_t opcode_hash_values[OPCODE_HASH_SIZE];
+
+// Packs up to 8 mnemonic bytes, returns 0 when the mnemonic is too long
+static uint64_t packMnemonic(const char *s, size_t len) {
+	uint64_t key = 0;
+
+	if (len == 0 || len > sizeof key)
+		return 0;
+	for (size_t i = 0; i < len; i++)
+		key |= (uint64_t)(unsigned char)s[i] << (8 * i);
+	return key;
+}
+
+static inline unsigned opcodeHashSlot(uint64_t key) {
+	return (unsigned)((key * opcode_hash_multiplier) >>
+					  (64 - OPCODE_HASH_BITS));
+}
+
+void initOpcodeLookup(void) {
+	uint64_t seed = 0x9E3779B97F4A7C15ull;
+
+	for (;;) {
+		int collision = 0;
+
+		// splitmix64 step, forced odd
+		seed += 0x9E3779B97F4A7C15ull;
+		uint64_t z = seed;
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+		opcode_hash_multiplier = (z ^ (z >> 31)) | 1;
+
+		memset(opcode_hash_keys, 0, sizeof opcode_hash_keys);
+
+		for (int op = 0; op < NUM_INSTRUCTIONS && !collision; op++) {
+			const char *mnemonic = instruction_mnemonics[op];
+			uint64_t key = packMnemonic(mnemonic, strlen(mnemonic));
+			unsigned slot = opcodeHashSlot(key);
+
+			if (opcode_hash_keys[slot] != 0) {
+				collision = 1;
+			} else {
+				opcode_hash_keys[slot] = key;
+				opcode_hash_values[slot] = (uint8_t)op;
+			}
+		}
+
+		if (!collision)
+			return;
+	}
+}
+
+Opcode lookupOpcode(const char *mnemonic, size_t len) {
+	uint64_t key = packMnemonic(mnemonic, len);
+	unsigned slot = opcodeHashSlot(key);
+
+	if (key != 0 && opcode_hash_keys[slot] == key)
+		return (Opcode)opcode_hash_values[slot];
+	return NUM_INSTRUCTIONS;
+}
+
+// }}}
+
+// {{{ Instruction Parser
+
+Instruction parseInstructionTokens(const Token *tokens, int count,
+								   Arena *arena) {
+	Token t[MAX_LINE_TOKENS] = {{0}};
+	Instruction instruction;
+
+	memcpy(t, tokens, (size_t)count * sizeof *tokens);
+
+	instruction.type = lookupOpcode(t[0].start, t[0].length);
+
+	if (instruction.type != NUM_INSTRUCTIONS) {
+		instruction.format = instruction_formats[instruction.type];
+	} else {
+		instruction.format = UNKNOWN_TYPE;
+		errorf("Unknown instruction - %.*s\n", (int)t[0].length, t[0].start);
+	}
+
+	parseInstructionValues(&instruction, t, arena);
+	computeRegisterMasks(&instruction);
+	instruction.target = -1;
+
+	return instruction;
+}
+
+Instruction parseInstructionFromUser(char *instruction_unparsed,
+									 Arena *arena) {
+	Token tokens[MAX_LINE_TOKENS];
+	size_t length = strlen(instruction_unparsed);
+	int count = lexLine(instruction_unparsed, length, length, tokens,
+						MAX_LINE_TOKENS);
+
+	return parseInstructionTokens(tokens, count, arena);
+}
+
+// }}}
+
+// {{{ Labels
+
+static int isLabelChar(char c) {
+	return isalnum((unsigned char)c) || c == '_' || c == '.' || c == '$';
+}
+
+// Defines every `name:` at the start of [start, stop) at the index the next
+// instruction will get, and returns where the instruction text begins
+const char *parseLabels(Inputs *inputs, const char *start, const char *stop) {
+	for (;;) {
+		const char *p = start;
+
+		while (p < stop && isLabelChar(*p))
+			p++;
+		if (p == start || p == stop || *p != ':')
+			return start;
+
+		if (symbolDefine(&inputs->symbols, &inputs->arena, start,
+						 (size_t)(p - start),
+						 inputs->instructions_count) != 0)
+			errorf("Label %.*s is defined twice, keeping the first\n",
+				   (int)(p - start), start);
+
+		start = p + 1;
+		while (start < stop && isspace((unsigned char)*start))
+			start++;
+	}
+}
+
+// Defines every leading token followed by `:` as a label and returns how
+// many tokens were labels
+int defineLabelTokens(Inputs *inputs, const Token *tokens, int count,
+					  const char *stop) {
+	int labels = 0;
+
+	for (; labels < count; labels++) {
+		const Token *token = &tokens[labels];
+		const char *after = token->start + token->length;
+
+		if (after >= stop || *after != ':')
+			break;
+		for (uint32_t k = 0; k < token->length; k++)
+			if (!isLabelChar(token->start[k]))
+				return labels;
+
+		if (symbolDefine(&inputs->symbols, &inputs->arena, token->start,
+						 token->length, inputs->instructions_count) != 0)
+			errorf("Label %.*s is defined twice, keeping the first\n",
+				   (int)token->length, token->start);
+	}
+	return labels;
+}
+
+// Target operand of a branch without its `#`, or NULL if it has none
+static const char *branchOperand(const Instruction *ins) {
+	const char *operand = NULL;
+
+	if (ins->format == B_TYPE && ins->type != BR)
+		operand = ins->values.B.imm26;
+	else if (ins->format == CB_TYPE)
+		operand = ins->values.CB.imm19;
+
+	if (operand != NULL && *operand == '#')
+		operand++;
+	return operand;
+}
+
+// Numeric operands are offsets in instructions, anything else is a label
+static int isOffsetOperand(const char *operand) {
+	return *operand == '-' || *operand == '+' ||
+		   isdigit((unsigned char)*operand);
+}
+
+// Resolves every branch operand to an instruction index in one pass.
+// Returns the number of operands that could not be resolved.
+int resolveBranchTargets(Inputs *inputs) {
+	int unresolved = 0;
+
+	for (int i = 0; i < inputs->instructions_count; i++) {
+		Instruction *ins = &inputs->instructions[i];
+		const char *operand = branchOperand(ins);
+
+		ins->target = -1;
+		if (operand == NULL)
+			continue;
+
+		if (isOffsetOperand(operand)) {
+			ins->target = i + (int32_t)strtol(operand, NULL, 0);
+		} else {
+			ins->target =
+				symbolLookup(&inputs->symbols, operand, strlen(operand));
+			if (ins->target < 0) {
+				errorf("Unknown label - %s\n", operand);
+				unresolved++;
+			}
+		}
+	}
+
+	return unresolved;
+}
+
+// }}}
+
+/*
+ *  Hazard Analysis
+ */
+
+// {{{ Pipeline Configuration
+
+// Forwarding paths and register-file behaviour of the 5-stage pipeline. The
+// default (both paths and a split register file) is the textbook LEGv8
+// pipeline where only a load followed by a reader stalls.
+typedef enum {
+	BRANCH_IDEAL,
+	BRANCH_STALL,
+	BRANCH_NOT_TAKEN,
+	BRANCH_BTFN,
+	BRANCH_ONE_BIT,
+	BRANCH_TWO_BIT,
+	BRANCH_GSHARE,
+	NUM_BRANCH_POLICIES
+} BranchPolicy;
+
+const char *branch_policy_names[NUM_BRANCH_POLICIES] = {
+	[BRANCH_IDEAL] = "ideal",		 [BRANCH_STALL] = "stall",
+	[BRANCH_NOT_TAKEN] = "not-taken", [BRANCH_BTFN] = "btfn",
+	[BRANCH_ONE_BIT] = "1bit",		 [BRANCH_TWO_BIT] = "2bit",
+	[BRANCH_GSHARE] = "gshare",
+};
+
+typedef enum {
+	REPLACE_LRU,
+	REPLACE_PLRU,
+	REPLACE_RANDOM,
+	NUM_REPLACEMENT_POLICIES
+} ReplacementPolicy;
+
+const char *replacement_names[NUM_REPLACEMENT_POLICIES] = {
+	[REPLACE_LRU] = "lru",
+	[REPLACE_PLRU] = "plru",
+	[REPLACE_RANDOM] = "random",
+};
+
+// L1 data cache in front of ME. A size of 0 means every access takes one
+// cycle. Write-back caches allocate on a write miss; write-through ones go
+// around the cache, and neither waits for the write itself to finish.
+typedef struct {
+	uint32_t size;
+	uint32_t line_size;
+	uint16_t ways;
+	uint16_t miss_latency;
+	uint8_t replacement;
+	uint8_t write_back;
+} CacheConfig;
+
+// Branches are ideal (no control hazards), there is no data cache and EX
+// takes one cycle by default so the textbook cycle counts stay unchanged
+// unless one is picked. With functional_units set every opcode runs on its
+// unit for its latency (instruction_latencies[] unless overridden in
+// latencies[]); an unpipelined unit accepts nothing else until it is done.
+// Up to issue_width instructions enter IF together, with at most ports[p]
+// of them using each kind of port. out_of_order swaps the 5-stage pipeline
+// for a Tomasulo core with rob_size entries, stations[u] reservation
+// stations per functional unit and commit_width commits per cycle.
+typedef struct {
+	uint8_t forward_ex_mem;
+	uint8_t forward_mem_wb;
+	uint8_t split_register_file;
+	uint8_t branch_policy;
+	uint8_t mispredict_penalty;
+	uint8_t predictor_bits;
+	uint8_t functional_units;
+	uint8_t unpipelined_units;
+	uint8_t latencies[NUM_INSTRUCTIONS];
+	uint8_t issue_width;
+	uint8_t ports[NUM_PORTS];
+	uint8_t out_of_order;
+	uint8_t commit_width;
+	uint16_t rob_size;
+	uint8_t stations[NUM_UNITS];
+	CacheConfig cache;
+} PipelineConfig;
+
+#define PIPELINE_CONFIG_DEFAULT                                                \
+	{                                                                          \
+		.forward_ex_mem = 1, .forward_mem_wb = 1, .split_register_file = 1,    \
+		.branch_policy = BRANCH_IDEAL, .mispredict_penalty = 1,                \
+		.predictor_bits = 10, .functional_units = 0,                           \
+		.unpipelined_units = 1 << UNIT_DIV, .issue_width = 1,                  \
+		.ports = {[PORT_ALU] = 8, [PORT_MEM] = 2, [PORT_BRANCH] = 1},          \
+		.out_of_order = 0, .commit_width = 4, .rob_size = 64,                  \
+		.stations = {[UNIT_ALU] = 16, [UNIT_MUL] = 8, [UNIT_DIV] = 4,          \
+					 [UNIT_MEM] = 16, [UNIT_BRANCH] = 8},                      \
+		.cache = {.size = 0, .line_size = 64, .ways = 4, .miss_latency = 10,   \
+				  .replacement = REPLACE_LRU, .write_back = 1},                \
+	}
+
+const char *forwardingName(const PipelineConfig *config) {
+	if (config->forward_ex_mem && config->forward_mem_wb)
+		return "full";
+	if (config->forward_ex_mem)
+		return "ex-mem";
+	if (config->forward_mem_wb)
+		return "mem-wb";
+	return "none";
+}
+
+// Accepts full, none, ex-mem or mem-wb
+int setForwarding(PipelineConfig *config, const char *mode) {
+	if (strcmp(mode, "full") == 0) {
+		config->forward_ex_mem = 1;
+		config->forward_mem_wb = 1;
+	} else if (strcmp(mode, "none") == 0) {
+		config->forward_ex_mem = 0;
+		config->forward_mem_wb = 0;
+	} else if (strcmp(mode, "ex-mem") == 0) {
+		config->forward_ex_mem = 1;
+		config->forward_mem_wb = 0;
+	} else if (strcmp(mode, "mem-wb") == 0) {
+		config->forward_ex_mem = 0;
+		config->forward_mem_wb = 1;
+	} else {
+		return -1;
+	}
+	return 0;
+}
+
+// Parses a byte count with an optional K or M suffix
+static uint64_t parseSize(const char *text, char **end) {
+	uint64_t value = strtoull(text, end, 0);
+
+	if (**end == 'K' || **end == 'k')
+		value <<= 10, (*end)++;
+	else if (**end == 'M' || **end == 'm')
+		value <<= 20, (*end)++;
+	return value;
+}
+
+static int isPowerOfTwo(uint64_t value) {
+	return value != 0 && (value & (value - 1)) == 0;
+}
+
+// Accepts size:ways:line (e.g. 32K:4:64), or 0 to remove the cache. Every
+// part is a power of two, with at most 64 ways and at least one set.
+int setCacheGeometry(PipelineConfig *config, const char *geometry) {
+	char *end;
+	uint64_t size = parseSize(geometry, &end);
+
+	if (size == 0 && *end == '\0') {
+		config->cache.size = 0;
+		return 0;
+	}
+	if (*end != ':')
+		return -1;
+	uint64_t ways = strtoull(end + 1, &end, 0);
+	if (*end != ':')
+		return -1;
+	uint64_t line = parseSize(end + 1, &end);
+
+	if (*end != '\0' || !isPowerOfTwo(size) || !isPowerOfTwo(ways) ||
+		!isPowerOfTwo(line) || ways > 64 || line < 8 || size > (1u << 30) ||
+		size < ways * line)
+		return -1;
+
+	config->cache.size = (uint32_t)size;
+	config->cache.ways = (uint16_t)ways;
+	config->cache.line_size = (uint32_t)line;
+	return 0;
+}
+
+int setReplacementPolicy(PipelineConfig *config, const char *policy) {
+	for (int i = 0; i < NUM_REPLACEMENT_POLICIES; i++) {
+		if (strcmp(policy, replacement_names[i]) == 0) {
+			config->cache.replacement = (uint8_t)i;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+// EX cycles of `op` under this configuration
+static inline uint32_t opcodeLatency(const PipelineConfig *config, int op) {
+	if (!config->functional_units || op >= NUM_INSTRUCTIONS)
+		return 1;
+	return config->latencies[op] != 0 ? config->latencies[op]
+									  : instruction_latencies[op];
+}
+
+// Accepts OP=cycles (e.g. MUL=4, in any case) and turns functional units on
+int setOpcodeLatency(PipelineConfig *config, const char *assignment) {
+	const char *equals = strchr(assignment, '=');
+	char mnemonic[8];
+	char *end;
+
+	if (equals == NULL || equals - assignment > (long)sizeof mnemonic)
+		return -1;
+	size_t length = (size_t)(equals - assignment);
+	for (size_t k = 0; k < length; k++)
+		mnemonic[k] = (char)toupper((unsigned char)assignment[k]);
+	Opcode op = lookupOpcode(mnemonic, length);
+	unsigned long cycles = strtoul(equals + 1, &end, 0);
+	if (op == NUM_INSTRUCTIONS || *end != '\0' || cycles < 1 || cycles > 255)
+		return -1;
+
+	config->latencies[op] = (uint8_t)cycles;
+	config->functional_units = 1;
+	return 0;
+}
+
+// Marks the unit named `unit` (alu, mul, div, mem or branch) as pipelined
+// or not and turns functional units on
+int setUnitPipelined(PipelineConfig *config, const char *unit, int pipelined) {
+	for (int i = 0; i < NUM_UNITS; i++) {
+		if (strcmp(unit, unit_names[i]) == 0) {
+			if (pipelined)
+				config->unpipelined_units &= (uint8_t)~(1u << i);
+			else
+				config->unpipelined_units |= (uint8_t)(1u << i);
+			config->functional_units = 1;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+#define MAX_ISSUE_WIDTH 8
+
+// Accepts alu:mem:branch port counts (e.g. 4:2:1), each at least 1
+int setIssuePorts(PipelineConfig *config, const char *ports) {
+	const char *text = ports;
+	char *end;
+
+	for (int p = 0; p < NUM_PORTS; p++) {
+		unsigned long count = strtoul(text, &end, 0);
+
+		if (end == text || count < 1 || count > MAX_ISSUE_WIDTH ||
+			*end != (p == NUM_PORTS - 1 ? '\0' : ':'))
+			return -1;
+		config->ports[p] = (uint8_t)count;
+		text = end + 1;
+	}
+	return 0;
+}
+
+#define MAX_ROB_SIZE 4096
+#define MAX_STATIONS 64
+
+// Accepts alu:mul:div:mem:branch reservation station counts (e.g.
+// 16:8:4:16:8), each between 1 and MAX_STATIONS
+int setReservationStations(PipelineConfig *config, const char *stations) {
+	const char *text = stations;
+	char *end;
+
+	for (int u = 0; u < NUM_UNITS; u++) {
+		unsigned long count = strtoul(text, &end, 0);
+
+		if (end == text || count < 1 || count > MAX_STATIONS ||
+			*end != (u == NUM_UNITS - 1 ? '\0' : ':'))
+			return -1;
+		config->stations[u] = (uint8_t)count;
+		text = end + 1;
+	}
+	return 0;
+}
+
+int setBranchPolicy(PipelineConfig *config, const char *policy) {
+	for (int i = 0; i < NUM_BRANCH_POLICIES; i++) {
+		if (strcmp(policy, branch_policy_names[i]) == 0) {
+			config->branch_policy = (uint8_t)i;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+// }}}
+
+// {{{ Analysis Types
+
+typedef enum {
+	HAZARD_NONE,
+	HAZARD_LOAD_USE,
+	HAZARD_DATA,
+	HAZARD_BRANCH,
+	HAZARD_MEMORY,
+	HAZARD_STRUCTURAL,
+	NUM_HAZARDS
+} HazardReason;
+
+const char *hazard_names[NUM_HAZARDS] = {
+	[HAZARD_NONE] = "none",
+	[HAZARD_LOAD_USE] = "load-use",
+	[HAZARD_DATA] = "data",
+	[HAZARD_BRANCH] = "branch",
+	[HAZARD_MEMORY] = "memory",
+	[HAZARD_STRUCTURAL] = "structural",
+};
+
+// Timing of one instruction through the 5-stage pipeline. Cycles are
+// 0-based; the instruction is in IF at issue_cycle and in WB four later.
+// control_stalls are the bubbles left by a mispredicted branch before it,
+// stalls the data-hazard bubbles on top of those. memory_stalls are extra
+// cycles the instruction itself spends in ME waiting on a cache miss, and
+// execute_extra the cycles a multi-cycle unit keeps it in EX past the first
+// (ME and WB move back by that much; nothing behind it waits for them).
+// Out of order, queue_cycles are spent in a reservation station between ID
+// and EX and retire_cycles in the reorder buffer between ME and WB (commit).
+typedef struct {
+	uint64_t issue_cycle;
+	uint32_t stalls;
+	uint32_t control_stalls;
+	uint32_t memory_stalls;
+	uint32_t queue_cycles;
+	uint32_t retire_cycles;
+	uint16_t execute_extra;
+	uint8_t reason;
+} InstructionTiming;
+
+// Ports booked in one cycle, a bit per port in use
+typedef struct {
+	uint64_t cycle;
+	uint8_t ports[NUM_PORTS];
+} CalendarSlot;
+
+#define CALENDAR_EMPTY UINT64_MAX
+
+// State of the out-of-order core. Instructions arrive in program order and
+// are timed on arrival: everything older is already timed, and an older
+// instruction always wins a port over a younger one, which is the same
+// outcome as oldest-first select.
+//
+// ready[] is the rename table: the first EX cycle that can use the newest
+// value of each register. rob[] holds the commit cycle of the last rob_size
+// instructions and stations[u] the cycle each reservation station of unit u
+// is next free. The calendar books execution ports by cycle; it only has to
+// hold cycles from the current dispatch on, and grows when they collide.
+typedef struct {
+	uint64_t fetch_cycle;
+	uint64_t redirect;
+	uint8_t fetch_count;
+	uint64_t ready[NUM_REGISTERS];
+	uint64_t *rob;
+	uint64_t dispatched;
+	uint64_t *stations[NUM_UNITS];
+	uint64_t memory_order;
+	uint64_t commit_cycle;
+	uint8_t commit_count;
+	CalendarSlot *calendar;
+	uint64_t calendar_mask;
+} OutOfOrderCore;
+
+// Pipeline state carried from one instruction to the next. The scoreboard
+// keeps, per register (index 31 is the flags), the EX cycle of its last
+// writer, which cycles after it the value can be forwarded into EX, and the
+// first EX cycle that can read it from the register file instead. unit_free
+// is the first cycle each functional unit can start another instruction, and
+// finish the cycle after the last WB so far.
+//
+// The issue group is the set of instructions that entered IF in group_cycle.
+// next_issue equals group_cycle while the group can still take more; then
+// group_writes and group_ports decide whether the next instruction joins it.
+//
+// The branch predictor table is a flat array of 2^predictor_bits counters
+// allocated once per engine.
+typedef struct {
+	const PipelineConfig *config;
+	uint64_t next_issue;
+	uint64_t producer_ex[NUM_REGISTERS];
+	uint64_t register_file_ex[NUM_REGISTERS];
+	uint8_t forward_offsets[NUM_REGISTERS];
+	uint32_t load_writers;
+	uint64_t unit_free[NUM_UNITS];
+	uint64_t finish;
+	uint8_t latencies[NUM_INSTRUCTIONS];
+
+	uint64_t group_cycle;
+	uint32_t group_writes;
+	uint8_t group_size;
+	uint8_t group_ports[NUM_PORTS];
+	OutOfOrderCore *core;
+
+	uint32_t pending_control_stalls;
+	uint8_t *predictor;
+	uint32_t predictor_mask;
+	uint32_t history;
+	uint64_t branches, mispredictions;
+} HazardEngine;
+
+// Result of analysing a program once, reused by every report. For a listing
+// timings[i] belongs to instruction i and lives in the program arena. For an
+// executed run the rows follow the retired stream, indices[] maps each row
+// back to its instruction, and both arrays are owned by the Analysis (they
+// are only kept when a report needs them).
+typedef struct {
+	int valid;
+	int executed;
+	int halted;
+	uint64_t instructions_count;
+	uint64_t stalls;
+	uint64_t stalls_by_reason[NUM_HAZARDS];
+	uint64_t branches, mispredictions;
+	uint64_t total_cycles;
+	int issue_width;
+	int out_of_order;
+	int multicycle;
+	int streamed;
+	int cached;
+	uint64_t cache_accesses, cache_misses, cache_writebacks;
+	InstructionTiming *timings;
+	uint32_t *indices;
+	uint64_t timings_capacity;
+	int owns_timings;
+} Analysis;
+
+// }}}
+
+// {{{ Hazard Engine
+
+void hazardEngineInit(HazardEngine *engine, const PipelineConfig *config) {
+	memset(engine, 0, sizeof *engine);
+	engine->config = config;
+	for (int op = 0; op < NUM_INSTRUCTIONS; op++)
+		engine->latencies[op] = (uint8_t)opcodeLatency(config, op);
+
+	if (config->branch_policy >= BRANCH_ONE_BIT) {
+		size_t size = (size_t)1 << config->predictor_bits;
+
+		// 2-bit counters start weakly not-taken
+		engine->predictor = malloc(size);
+		memset(engine->predictor,
+			   config->branch_policy == BRANCH_ONE_BIT ? 0 : 1, size);
+		engine->predictor_mask = (uint32_t)(size - 1);
+	}
+
+	if (config->out_of_order) {
+		OutOfOrderCore *core = calloc(1, sizeof *core);
+
+		core->rob = calloc(config->rob_size, sizeof(uint64_t));
+		for (int u = 0; u < NUM_UNITS; u++)
+			core->stations[u] = calloc(config->stations[u], sizeof(uint64_t));
+		core->calendar_mask = 255;
+		core->calendar =
+			malloc((core->calendar_mask + 1) * sizeof(CalendarSlot));
+		memset(core->calendar, 0xFF,
+			   (core->calendar_mask + 1) * sizeof(CalendarSlot));
+		engine->core = core;
+	}
+}
+
+void hazardEngineFree(HazardEngine *engine) {
+	free(engine->predictor);
+	engine->predictor = NULL;
+
+	if (engine->core != NULL) {
+		free(engine->core->rob);
+		for (int u = 0; u < NUM_UNITS; u++)
+			free(engine->core->stations[u]);
+		free(engine->core->calendar);
+		free(engine->core);
+		engine->core = NULL;
+	}
+}
+
+// Predicts the branch at `pc`, trains the predictor with the real outcome
+// and returns 1 on a misprediction
+static int predictBranch(HazardEngine *engine, const Instruction *ins,
+						 uint64_t pc, int taken) {
+	uint32_t index = (uint32_t)pc & engine->predictor_mask;
+	int predicted = 0;
+
+	switch (engine->config->branch_policy) {
+
+	case BRANCH_STALL:
+		return 1;
+
+	case BRANCH_NOT_TAKEN:
+		predicted = 0;
+		break;
+
+	case BRANCH_BTFN:
+		predicted = !isConditionalBranch(*ins) ||
+					(ins->target >= 0 && (uint64_t)ins->target <= pc);
+		break;
+
+	case BRANCH_ONE_BIT:
+		predicted = engine->predictor[index];
+		engine->predictor[index] = (uint8_t)taken;
+		break;
+
+	case BRANCH_TWO_BIT:
+	case BRANCH_GSHARE: {
+		if (engine->config->branch_policy == BRANCH_GSHARE) {
+			index = (index ^ engine->history) & engine->predictor_mask;
+			engine->history =
+				((engine->history << 1) | (uint32_t)taken) &
+				engine->predictor_mask;
+		}
+
+		uint8_t counter = engine->predictor[index];
+		predicted = counter >= 2;
+		if (taken && counter < 3)
+			engine->predictor[index] = counter + 1;
+		else if (!taken && counter > 0)
+			engine->predictor[index] = counter - 1;
+		break;
+	}
+
+	default:
+		return 0;
+	}
+
+	return predicted != taken;
+}
+
+// First EX cycle at or after `ex` where register r can be obtained
+static inline uint64_t operandReadyCycle(const HazardEngine *engine, int r,
+										 uint64_t ex) {
+	while (ex < engine->register_file_ex[r]) {
+		uint64_t offset = ex - engine->producer_ex[r];
+
+		if (offset < 8 && (engine->forward_offsets[r] >> offset) & 1)
+			break;
+		ex++;
+	}
+	return ex;
+}
+
+// Moves the live slots (from `horizon` on) into a calendar of `size` slots;
+// returns 0 if two of them would share a slot
+static int calendarRehash(OutOfOrderCore *core, uint64_t size,
+						  uint64_t horizon) {
+	CalendarSlot *calendar = malloc(size * sizeof(CalendarSlot));
+
+	memset(calendar, 0xFF, size * sizeof(CalendarSlot));
+	for (uint64_t k = 0; k <= core->calendar_mask; k++) {
+		const CalendarSlot *slot = &core->calendar[k];
+
+		if (slot->cycle == CALENDAR_EMPTY || slot->cycle < horizon)
+			continue;
+		CalendarSlot *moved = &calendar[slot->cycle & (size - 1)];
+		if (moved->cycle != CALENDAR_EMPTY) {
+			free(calendar);
+			return 0;
+		}
+		*moved = *slot;
+	}
+
+	free(core->calendar);
+	core->calendar = calendar;
+	core->calendar_mask = size - 1;
+	return 1;
+}
+
+// Calendar slot of `cycle`. Slots before `horizon` are no longer needed, so
+// they are reused; a live slot in the way doubles the calendar instead.
+static CalendarSlot *calendarSlot(OutOfOrderCore *core, uint64_t cycle,
+								  uint64_t horizon) {
+	for (;;) {
+		CalendarSlot *slot = &core->calendar[cycle & core->calendar_mask];
+
+		if (slot->cycle == cycle)
+			return slot;
+		if (slot->cycle == CALENDAR_EMPTY || slot->cycle < horizon) {
+			slot->cycle = cycle;
+			memset(slot->ports, 0, sizeof slot->ports);
+			return slot;
+		}
+
+		uint64_t size = (core->calendar_mask + 1) * 2;
+		while (!calendarRehash(core, size, horizon))
+			size *= 2;
+	}
+}
+
+// Out-of-order counterpart of hazardEngineStep. Fetch and dispatch stay in
+// order (issue_width a cycle) and stall only when the ROB or the unit's
+// reservation stations are full. Renaming removes WAR and WAW hazards, so
+// an instruction waits in its station for its operands, an execution port
+// and, on an unpipelined unit, the unit itself. Memory operations start in
+// program order, and a cache miss only holds up the instructions that need
+// the loaded value. Commit is in order, commit_width a cycle.
+static InstructionTiming outOfOrderStep(HazardEngine *engine,
+										const Instruction *ins, uint64_t pc,
+										int taken, uint32_t memory_stalls) {
+	const PipelineConfig *config = engine->config;
+	OutOfOrderCore *core = engine->core;
+	InstructionTiming timing = {0};
+	int known = ins->type < NUM_INSTRUCTIONS;
+	int unit = known ? instruction_units[ins->type] : UNIT_ALU;
+	int port = unit_ports[unit];
+	uint32_t latency = known ? engine->latencies[ins->type] : 1;
+	int memory = isLoad(*ins) || isStore(*ins);
+
+	// Fetch resumes after a mispredicted branch has executed
+	uint64_t fetch = core->fetch_cycle;
+	if (core->redirect > fetch) {
+		timing.control_stalls = (uint32_t)(core->redirect - fetch);
+		fetch = core->redirect;
+	}
+
+	// Dispatch needs the ROB entry of the instruction rob_size back and a
+	// free reservation station
+	uint64_t dispatch = fetch + 1;
+	uint64_t *rob_entry = &core->rob[core->dispatched % config->rob_size];
+	if (*rob_entry + 1 > dispatch)
+		dispatch = *rob_entry + 1;
+
+	uint64_t *station = core->stations[unit];
+	for (int k = 1; k < config->stations[unit]; k++)
+		if (core->stations[unit][k] < *station)
+			station = &core->stations[unit][k];
+	if (*station > dispatch)
+		dispatch = *station;
+
+	if (dispatch != fetch + 1) {
+		timing.stalls = (uint32_t)(dispatch - fetch - 1);
+		timing.reason = HAZARD_STRUCTURAL;
+	} else if (timing.control_stalls != 0) {
+		timing.reason = HAZARD_BRANCH;
+	}
+	fetch = dispatch - 1;
+
+	// Wakeup: operands come from the rename table
+	uint64_t execute = dispatch + 1;
+	for (uint32_t reads = ins->read_mask; reads != 0; reads &= reads - 1) {
+		int r = __builtin_ctz(reads);
+
+		if (core->ready[r] > execute)
+			execute = core->ready[r];
+	}
+	if (engine->unit_free[unit] > execute)
+		execute = engine->unit_free[unit];
+	if (memory && core->memory_order > execute)
+		execute = core->memory_order;
+
+	// Select: the first cycle from there with a free port of this kind
+	uint8_t full = (uint8_t)((1u << config->ports[port]) - 1);
+	for (;; execute++) {
+		CalendarSlot *slot = calendarSlot(core, execute, dispatch);
+		uint8_t used = slot->ports[port];
+
+		if (used != full) {
+			slot->ports[port] = used | (uint8_t)(used + 1);
+			break;
+		}
+	}
+
+	uint64_t complete = execute + latency + 1 + memory_stalls;
+	uint64_t commit = complete > core->commit_cycle ? complete
+													: core->commit_cycle;
+	if (commit == core->commit_cycle &&
+		core->commit_count >= config->commit_width)
+		commit++;
+	if (commit != core->commit_cycle) {
+		core->commit_cycle = commit;
+		core->commit_count = 0;
+	}
+	core->commit_count++;
+
+	timing.issue_cycle = fetch;
+	timing.memory_stalls = memory_stalls;
+	timing.execute_extra = (uint16_t)(latency - 1);
+	timing.queue_cycles = (uint32_t)(execute - dispatch - 1);
+	timing.retire_cycles = (uint32_t)(commit - complete);
+
+	// Loaded values exist after ME, everything else after EX
+	uint64_t ready = isLoad(*ins) ? complete : execute + latency;
+	for (uint32_t writes = ins->write_mask; writes != 0; writes &= writes - 1)
+		core->ready[__builtin_ctz(writes)] = ready;
+
+	*rob_entry = commit;
+	*station = execute;
+	core->dispatched++;
+	if ((config->unpipelined_units >> unit) & 1)
+		engine->unit_free[unit] = execute + latency;
+	if (memory)
+		core->memory_order = execute;
+	if (commit + 1 > engine->finish)
+		engine->finish = commit + 1;
+
+	if (fetch != engine->next_issue)
+		core->fetch_count = 0;
+	core->fetch_count++;
+	engine->next_issue = fetch;
+
+	int closed = core->fetch_count >= config->issue_width;
+	if (isBranch(*ins)) {
+		engine->branches++;
+		closed |= taken;
+		if (predictBranch(engine, ins, pc, taken)) {
+			engine->mispredictions++;
+			core->redirect = execute + latency + config->mispredict_penalty;
+			closed = 1;
+		}
+	}
+	if (closed)
+		core->fetch_count = 0;
+	core->fetch_cycle = closed ? fetch + 1 : fetch;
+
+	return timing;
+}
+
+// Steps one instruction at static index `pc`; `taken` is the branch outcome
+// and is ignored for everything that is not a branch. `memory_stalls` holds
+// the instruction in ME, and everything behind it, for that many cycles.
+InstructionTiming hazardEngineStep(HazardEngine *engine, const Instruction *ins,
+								   uint64_t pc, int taken,
+								   uint32_t memory_stalls) {
+	const PipelineConfig *config = engine->config;
+	InstructionTiming timing = {0};
+
+	if (engine->core != NULL)
+		return outOfOrderStep(engine, ins, pc, taken, memory_stalls);
+
+	// Fetch waits out the bubbles of a mispredicted branch first
+	timing.control_stalls = engine->pending_control_stalls;
+	engine->next_issue += timing.control_stalls;
+	engine->pending_control_stalls = 0;
+
+	int known = ins->type < NUM_INSTRUCTIONS;
+	int unit = known ? instruction_units[ins->type] : UNIT_ALU;
+	uint32_t latency = known ? engine->latencies[ins->type] : 1;
+	int port = unit_ports[unit];
+	uint64_t wanted_ex = engine->next_issue + 2;
+	uint64_t ex = wanted_ex;
+	uint8_t reason = HAZARD_NONE;
+
+	// Joining an open group needs no register in common with what it
+	// writes (RAW or WAW) and a free port; otherwise it starts the next one
+	if (engine->group_size != 0 && engine->next_issue == engine->group_cycle) {
+		if ((ins->read_mask | ins->write_mask) & engine->group_writes) {
+			ex++;
+			reason = HAZARD_DATA;
+		} else if (engine->group_ports[port] >= config->ports[port]) {
+			ex++;
+			reason = HAZARD_STRUCTURAL;
+		}
+	}
+
+	// Forwarding windows need not be contiguous (e.g. EX/MEM without
+	// MEM/WB), so iterate until every operand is available in the same cycle
+	// and nothing else holds the instruction back
+	for (uint64_t start = ex + 1; start != ex;) {
+		start = ex;
+		for (uint32_t reads = ins->read_mask; reads != 0;
+			 reads &= reads - 1) {
+			int r = __builtin_ctz(reads);
+			uint64_t ready = operandReadyCycle(engine, r, ex);
+
+			if (ready != ex) {
+				ex = ready;
+				reason = (engine->load_writers >> r) & 1 ? HAZARD_LOAD_USE
+														 : HAZARD_DATA;
+			}
+		}
+
+		// An unpipelined unit is busy until its last instruction is done
+		if (ex < engine->unit_free[unit]) {
+			ex = engine->unit_free[unit];
+			reason = HAZARD_STRUCTURAL;
+		}
+
+		// Registers are written in program order, so a quick write waits
+		// for a slower, older write to the same register (WAW)
+		for (uint32_t writes = ins->write_mask; writes != 0;
+			 writes &= writes - 1) {
+			int r = __builtin_ctz(writes);
+
+			if (ex + latency - 1 <= engine->producer_ex[r]) {
+				ex = engine->producer_ex[r] + 2 - latency;
+				reason = HAZARD_DATA;
+			}
+		}
+	}
+
+	if (ex != wanted_ex) {
+		timing.stalls = (uint32_t)(ex - wanted_ex);
+		timing.reason = reason;
+	} else if (timing.control_stalls != 0) {
+		timing.reason = HAZARD_BRANCH;
+	}
+
+	timing.issue_cycle = engine->next_issue + timing.stalls;
+	timing.memory_stalls = memory_stalls;
+	timing.execute_extra = (uint16_t)(latency - 1);
+	// Pipelined units take another instruction in the same cycle as long as
+	// there are ports for it
+	engine->unit_free[unit] =
+		ex + ((config->unpipelined_units >> unit) & 1 ? latency : 0);
+
+	if (engine->group_size == 0 || timing.issue_cycle != engine->group_cycle) {
+		engine->group_cycle = timing.issue_cycle;
+		engine->group_writes = 0;
+		engine->group_size = 0;
+		memset(engine->group_ports, 0, sizeof engine->group_ports);
+	}
+	engine->group_writes |= ins->write_mask;
+	engine->group_size++;
+	engine->group_ports[port]++;
+
+	// WB is two cycles after the last EX cycle
+	uint64_t finish = ex + latency + 2 + memory_stalls;
+	if (finish > engine->finish)
+		engine->finish = finish;
+
+	// A full group, a cache miss and a taken branch (which redirects fetch)
+	// all close the group
+	int closed = engine->group_size >= config->issue_width ||
+				 memory_stalls != 0;
+
+	if (isBranch(*ins)) {
+		engine->branches++;
+		closed |= taken;
+		if (predictBranch(engine, ins, pc, taken)) {
+			engine->mispredictions++;
+			engine->pending_control_stalls = config->mispredict_penalty;
+			closed = 1;
+		}
+	}
+	engine->next_issue =
+		closed ? timing.issue_cycle + 1 + memory_stalls : timing.issue_cycle;
+
+	if (ins->write_mask != 0) {
+		// ALU results exist after EX, loaded values only after ME
+		int load = isLoad(*ins);
+		uint8_t offsets = 0;
+
+		if (config->forward_ex_mem && !load)
+			offsets |= 1 << 1;
+		if (config->forward_mem_wb)
+			offsets |= 1 << 2;
+
+		// WB is two cycles after EX (plus any cycles waiting in ME); without
+		// a split register file the reader's ID has to come one cycle after
+		uint64_t produced = ex + latency - 1 + memory_stalls;
+		uint64_t register_file =
+			produced + (config->split_register_file ? 3 : 4);
+
+		for (uint32_t writes = ins->write_mask; writes != 0;
+			 writes &= writes - 1) {
+			int r = __builtin_ctz(writes);
+
+			engine->producer_ex[r] = produced;
+			engine->register_file_ex[r] = register_file;
+			engine->forward_offsets[r] = offsets;
+		}
+
+		if (load)
+			engine->load_writers |= ins->write_mask;
+		else
+			engine->load_writers &= ~ins->write_mask;
+	}
+
+	return timing;
+}
+
+// Cycle count once every issued instruction has left WB
+uint64_t hazardEngineTotalCycles(const HazardEngine *engine) {
+	uint64_t drained = engine->next_issue + 4;
+	return engine->finish > drained ? engine->finish : drained;
+}
+
+// Whether `b` will time every following instruction exactly like `a`, with
+// all cycles moved by a.next_issue - b.next_issue. Only registers that can
+// still stall the next instruction are compared. Predictor tables are not.
+int hazardEngineEquivalent(const HazardEngine *a, const HazardEngine *b) {
+	int64_t shift = (int64_t)(a->next_issue - b->next_issue);
+
+	if (a->pending_control_stalls != b->pending_control_stalls)
+		return 0;
+
+	int open_a = a->group_size != 0 && a->next_issue == a->group_cycle;
+	int open_b = b->group_size != 0 && b->next_issue == b->group_cycle;
+	if (open_a != open_b ||
+		(open_a && (a->group_size != b->group_size ||
+					a->group_writes != b->group_writes ||
+					memcmp(a->group_ports, b->group_ports,
+						   sizeof a->group_ports) != 0)))
+		return 0;
+
+	for (int unit = 0; unit < NUM_UNITS; unit++) {
+		int busy_a = a->unit_free[unit] > a->next_issue + 2;
+		int busy_b = b->unit_free[unit] > b->next_issue + 2;
+
+		if (busy_a != busy_b ||
+			(busy_a &&
+			 (int64_t)(a->unit_free[unit] - b->unit_free[unit]) != shift))
+			return 0;
+	}
+
+	for (int r = 0; r < NUM_REGISTERS; r++) {
+		int pending_a = a->register_file_ex[r] > a->next_issue + 2;
+		int pending_b = b->register_file_ex[r] > b->next_issue + 2;
+
+		if (pending_a != pending_b)
+			return 0;
+		if (!pending_a)
+			continue;
+		if ((int64_t)(a->producer_ex[r] - b->producer_ex[r]) != shift ||
+			(int64_t)(a->register_file_ex[r] - b->register_file_ex[r]) !=
+				shift ||
+			a->forward_offsets[r] != b->forward_offsets[r] ||
+			((a->load_writers ^ b->load_writers) >> r & 1))
+			return 0;
+	}
+	return 1;
+}
+
+// }}}
+
+// {{{ Data Cache
+
+// Tags of one set are contiguous so a lookup scans a few adjacent words.
+// A tag is the line address; empty lines hold CACHE_EMPTY. LRU keeps a use
+// stamp per line; tree PLRU keeps ways - 1 direction bits per set, where bit
+// n of a set's word is node n of the tree (the root is node 1).
+typedef struct {
+	const CacheConfig *config;
+	uint64_t *tags;
+	uint64_t *stamps;
+	uint64_t *plru;
+	uint8_t *dirty;
+	uint64_t set_mask;
+	uint32_t ways;
+	uint8_t line_bits, way_bits;
+	uint64_t clock, random;
+	uint64_t accesses, misses, writebacks;
+} Cache;
+
+#define CACHE_EMPTY UINT64_MAX
+
+void cacheInit(Cache *cache, const CacheConfig *config) {
+	uint64_t lines = config->size / config->line_size;
+
+	memset(cache, 0, sizeof *cache);
+	cache->config = config;
+	cache->ways = config->ways;
+	cache->set_mask = lines / config->ways - 1;
+	cache->line_bits = (uint8_t)__builtin_ctz(config->line_size);
+	cache->way_bits = (uint8_t)__builtin_ctz(config->ways);
+	cache->random = 0x9E3779B97F4A7C15ull;
+
+	cache->tags = malloc(lines * sizeof *cache->tags);
+	cache->stamps = calloc(lines, sizeof *cache->stamps);
+	cache->plru = calloc(lines / config->ways, sizeof *cache->plru);
+	cache->dirty = calloc(lines, 1);
+	memset(cache->tags, 0xFF, lines * sizeof *cache->tags);
+}
+
+void cacheFree(Cache *cache) {
+	free(cache->tags);
+	free(cache->stamps);
+	free(cache->plru);
+	free(cache->dirty);
+	memset(cache, 0, sizeof *cache);
+}
+
+// Points every node on the way's path away from it
+static inline void plruTouch(uint64_t *tree, uint32_t way, int levels) {
+	uint32_t node = 1;
+
+	for (int level = levels - 1; level >= 0; level--) {
+		uint32_t bit = (way >> level) & 1;
+
+		if (bit)
+			*tree &= ~(1ull << node);
+		else
+			*tree |= 1ull << node;
+		node = node * 2 + bit;
+	}
+}
+
+static inline uint32_t plruVictim(uint64_t tree, int levels) {
+	uint32_t node = 1, way = 0;
+
+	for (int level = 0; level < levels; level++) {
+		uint32_t bit = (uint32_t)(tree >> node) & 1;
+
+		way = way * 2 + bit;
+		node = node * 2 + bit;
+	}
+	return way;
+}
+
+// Looks the access up, updates the replacement state and returns the cycles
+// it adds to ME: the miss latency when a line has to be fetched, else 0
+uint32_t cacheAccess(Cache *cache, uint64_t address, int is_write) {
+	const CacheConfig *config = cache->config;
+	uint64_t line = address >> cache->line_bits;
+	uint64_t set = line & cache->set_mask;
+	uint64_t first = set << cache->way_bits;
+	uint64_t *tags = &cache->tags[first];
+	uint32_t latency = 0;
+	uint32_t way;
+
+	cache->accesses++;
+	cache->clock++;
+
+	for (way = 0; way < cache->ways; way++)
+		if (tags[way] == line)
+			break;
+
+	if (way == cache->ways) {
+		cache->misses++;
+
+		// Write-through writes go straight to memory without a fill
+		if (is_write && !config->write_back)
+			return 0;
+
+		if (config->replacement == REPLACE_LRU) {
+			way = 0;
+			for (uint32_t w = 1; w < cache->ways; w++)
+				if (cache->stamps[first + w] < cache->stamps[first + way])
+					way = w;
+		} else if (config->replacement == REPLACE_PLRU) {
+			way = plruVictim(cache->plru[set], cache->way_bits);
+		} else {
+			cache->random ^= cache->random << 13;
+			cache->random ^= cache->random >> 7;
+			cache->random ^= cache->random << 17;
+			way = (uint32_t)cache->random & (cache->ways - 1);
+		}
+
+		if (tags[way] != CACHE_EMPTY && cache->dirty[first + way])
+			cache->writebacks++;
+		tags[way] = line;
+		cache->dirty[first + way] = 0;
+		latency = config->miss_latency;
+	}
+
+	cache->stamps[first + way] = cache->clock;
+	if (config->replacement == REPLACE_PLRU)
+		plruTouch(&cache->plru[set], way, cache->way_bits);
+	if (is_write && config->write_back)
+		cache->dirty[first + way] = 1;
+
+	return latency;
+}
+
+// }}}
+
+/*
+ *  Execution
+ */
+
+// {{{ Sparse Memory
+
+// Byte-addressable memory made of 4 KiB pages found through an open-addressing
+// table keyed by page number. Untouched memory reads as zero. Values are
+// stored in host byte order, which matches LEGv8 on little-endian hosts.
+#define PAGE_BITS 12
+#define PAGE_SIZE (1u << PAGE_BITS)
+
+typedef struct {
+	uint64_t *keys;
+	uint8_t **pages;
+	size_t capacity, count;
+	uint64_t last_key;
+	uint8_t *last_page;
+} SparseMemory;
+
+void memoryInit(SparseMemory *memory) {
+	memset(memory, 0, sizeof *memory);
+	memory->capacity = 64;
+	memory->keys = calloc(memory->capacity, sizeof(uint64_t));
+	memory->pages = calloc(memory->capacity, sizeof(uint8_t *));
+}
+
+void memoryFree(SparseMemory *memory) {
+	for (size_t i = 0; i < memory->capacity; i++)
+		free(memory->pages[i]);
+	free(memory->keys);
+	free(memory->pages);
+	memset(memory, 0, sizeof *memory);
+}
+
+static inline size_t memorySlot(uint64_t key, size_t capacity) {
+	return (size_t)((key * 0x9E3779B97F4A7C15ull) >> 32) & (capacity - 1);
+}
+
+static void memoryGrow(SparseMemory *memory) {
+	size_t old_capacity = memory->capacity;
+	uint64_t *old_keys = memory->keys;
+	uint8_t **old_pages = memory->pages;
+
+	memory->capacity *= 2;
+	memory->keys = calloc(memory->capacity, sizeof(uint64_t));
+	memory->pages = calloc(memory->capacity, sizeof(uint8_t *));
+
+	for (size_t i = 0; i < old_capacity; i++) {
+		if (old_keys[i] == 0)
+			continue;
+
+		size_t slot = memorySlot(old_keys[i], memory->capacity);
+		while (memory->keys[slot] != 0)
+			slot = (slot + 1) & (memory->capacity - 1);
+		memory->keys[slot] = old_keys[i];
+		memory->pages[slot] = old_pages[i];
+	}
+
+	free(old_keys);
+	free(old_pages);
+}
+
+// Page holding `address`, allocated on first write; NULL for an unwritten
+// page when `create` is 0
+static uint8_t *memoryPage(SparseMemory *memory, uint64_t address,
+						   int create) {
+	// Keys are offset by one so that 0 marks an empty slot
+	uint64_t key = (address >> PAGE_BITS) + 1;
+
+	if (key == memory->last_key)
+		return memory->last_page;
+
+	size_t slot = memorySlot(key, memory->capacity);
+	while (memory->keys[slot] != 0 && memory->keys[slot] != key)
+		slot = (slot + 1) & (memory->capacity - 1);
+
+	if (memory->keys[slot] == 0) {
+		if (!create)
+			return NULL;
+
+		if (2 * (memory->count + 1) > memory->capacity) {
+			memoryGrow(memory);
+			return memoryPage(memory, address, create);
+		}
+
+		memory->keys[slot] = key;
+		memory->pages[slot] = calloc(1, PAGE_SIZE);
+		memory->count++;
+	}
+
+	memory->last_key = key;
+	memory->last_page = memory->pages[slot];
+	return memory->last_page;
+}
+
+static inline uint64_t memoryRead(SparseMemory *memory, uint64_t address,
+								  unsigned size) {
+	uint64_t value = 0;
+	uint32_t offset = (uint32_t)(address & (PAGE_SIZE - 1));
+
+	if (offset + size <= PAGE_SIZE) {
+		uint8_t *page = (address >> PAGE_BITS) + 1 == memory->last_key
+							? memory->last_page
+							: memoryPage(memory, address, 0);
+		if (page != NULL)
+			memcpy(&value, page + offset, size);
+		return value;
+	}
+
+	for (unsigned i = 0; i < size; i++) {
+		uint8_t *page = memoryPage(memory, address + i, 0);
+		if (page != NULL)
+			value |= (uint64_t)page[(address + i) & (PAGE_SIZE - 1)]
+					 << (8 * i);
+	}
+	return value;
+}
+
+static inline void memoryWrite(SparseMemory *memory, uint64_t address,
+							   uint64_t value, unsigned size) {
+	uint32_t offset = (uint32_t)(address & (PAGE_SIZE - 1));
+
+	if (offset + size <= PAGE_SIZE) {
+		uint8_t *page = (address >> PAGE_BITS) + 1 == memory->last_key
+							? memory->last_page
+							: memoryPage(memory, address, 1);
+		memcpy(page + offset, &value, size);
+		return;
+	}
+
+	for (unsigned i = 0; i < size; i++)
+		memoryPage(memory, address + i, 1)[(address + i) & (PAGE_SIZE - 1)] =
+			(uint8_t)(value >> (8 * i));
+}
+
+// }}}
+
+// {{{ Machine State
+
+// Architectural state of a running program. The PC is an instruction index;
+// register values that hold code addresses (LR, BR targets) are byte
+// addresses, i.e. index * 4.
+typedef struct {
+	int64_t x[NUM_REGISTERS + 1];
+	uint8_t n, z, c, v;
+	uint64_t pc;
+	uint64_t steps;
+	int halted;
+	SparseMemory memory;
+} Machine;
+
+#define MACHINE_STACK_TOP 0x7FFFFFF0ull
+#define DEFAULT_MAX_STEPS 10000000ull
+
+// One retired instruction: its static index, top bit set if a branch was taken
+#define RETIRED_TAKEN (1u << 31)
+
+void machineInit(Machine *machine, const Inputs *inputs) {
+	memset(machine, 0, sizeof *machine);
+	memoryInit(&machine->memory);
+	machine->x[REG_SP] = (int64_t)MACHINE_STACK_TOP;
+
+	// Returning from the top level jumps past the end and halts
+	machine->x[REG_LR] = (int64_t)inputs->instructions_count * 4;
+}
+
+void machineFree(Machine *machine) { memoryFree(&machine->memory); }
+
+static int64_t immediateValue(const char *text) {
+	if (text == NULL)
+		return 0;
+	if (*text == '#')
+		text++;
+	return strtoll(text, NULL, 0);
+}
+
+// }}}
+
+// {{{ Pre-decoded Program
+
+// The parsed program lowered once into fixed 16-byte records: operands are
+// register indices, immediates and branch targets are already numbers, and
+// `handler` selects the interpreter routine. Reads of a missing operand use
+// XZR (always zero) and writes to XZR go to REG_SINK, so no handler has to
+// check for either.
+#define REG_SINK NUM_REGISTERS
+
+#define HANDLER_TABLE(X)                                                       \
+	X(H_ADD)                                                                   \
+	X(H_ADDS)                                                                  \
+	X(H_SUB)                                                                   \
+	X(H_SUBS)                                                                  \
+	X(H_AND)                                                                   \
+	X(H_ANDS)                                                                  \
+	X(H_ORR)                                                                   \
+	X(H_EOR)                                                                   \
+	X(H_LSL)                                                                   \
+	X(H_LSR)                                                                   \
+	X(H_ASR)                                                                   \
+	X(H_LSLV)                                                                  \
+	X(H_LSRV)                                                                  \
+	X(H_ASRV)                                                                  \
+	X(H_MUL)                                                                   \
+	X(H_UMULH)                                                                 \
+	X(H_SMULH)                                                                 \
+	X(H_UDIV)                                                                  \
+	X(H_SDIV)                                                                  \
+	X(H_ADDI)                                                                  \
+	X(H_ADDIS)                                                                 \
+	X(H_SUBI)                                                                  \
+	X(H_SUBIS)                                                                 \
+	X(H_ANDI)                                                                  \
+	X(H_ORRI)                                                                  \
+	X(H_EORI)                                                                  \
+	X(H_LDUR)                                                                  \
+	X(H_LDURB)                                                                 \
+	X(H_LDURH)                                                                 \
+	X(H_LDURSW)                                                                \
+	X(H_STUR)                                                                  \
+	X(H_STURB)                                                                 \
+	X(H_STURH)                                                                 \
+	X(H_MOVI)                                                                  \
+	X(H_MOVK)                                                                  \
+	X(H_MOVR)                                                                  \
+	X(H_SXTW)                                                                  \
+	X(H_SXTB)                                                                  \
+	X(H_SXTH)                                                                  \
+	X(H_UXTB)                                                                  \
+	X(H_UXTH)                                                                  \
+	X(H_UXTW)                                                                  \
+	X(H_B)                                                                     \
+	X(H_BL)                                                                    \
+	X(H_BR)                                                                    \
+	X(H_CBZ)                                                                   \
+	X(H_CBNZ)                                                                  \
+	X(H_BCOND)                                                                 \
+	X(H_NOP)                                                                   \
+	X(H_HALT)
+
+#define HANDLER_ENUM(name) name,
+
+typedef enum { HANDLER_TABLE(HANDLER_ENUM) NUM_HANDLERS } Handler;
+
+#undef HANDLER_ENUM
+
+typedef struct {
+	uint8_t handler;
+	uint8_t rd, rn, rm;
+	uint32_t target;
+	int64_t imm;
+} DecodedInstruction;
+
+// Condition codes stored in `rm` of H_BCOND
+enum { COND_EQ, COND_NE, COND_GT, COND_LT, COND_GE, COND_LE };
+
+static inline uint8_t sourceRegister(Register r) {
+	return r < NUM_REGISTERS ? r : REG_XZR;
+}
+
+static inline uint8_t destinationRegister(Register r) {
+	return r < REG_XZR ? r : REG_SINK;
+}
+
+// Lowers every instruction into the arena; the record after the last
+// instruction is H_HALT, and every branch that leaves the program targets it
+DecodedInstruction *decodeProgram(Inputs *inputs) {
+	uint32_t count = (uint32_t)inputs->instructions_count;
+	DecodedInstruction *code = (DecodedInstruction *)arenaAlloc(
+		&inputs->arena, (count + 1) * sizeof(DecodedInstruction));
+
+	for (uint32_t i = 0; i < count; i++) {
+		const Instruction *ins = &inputs->instructions[i];
+		DecodedInstruction *d = &code[i];
+		int32_t target = ins->target;
+
+		d->handler = H_NOP;
+		d->rd = REG_SINK;
+		d->rn = d->rm = REG_XZR;
+		d->imm = 0;
+		d->target = target >= 0 && (uint32_t)target < count ? (uint32_t)target
+															: count;
+
+		switch (ins->format) {
+
+		case R_TYPE: {
+			const RVals *r = &ins->values.R;
+			static const uint8_t handlers[NUM_INSTRUCTIONS] = {
+				[ADD] = H_ADD,	   [ADDS] = H_ADDS,	  [SUB] = H_SUB,
+				[SUBS] = H_SUBS,   [AND] = H_AND,	  [ANDS] = H_ANDS,
+				[ORR] = H_ORR,	   [EOR] = H_EOR,	  [LSL] = H_LSL,
+				[LSR] = H_LSR,	   [ASR] = H_ASR,	  [MUL] = H_MUL,
+				[UMULH] = H_UMULH, [SMULH] = H_SMULH, [UDIV] = H_UDIV,
+				[SDIV] = H_SDIV,   [CMP] = H_SUBS,	  [NOP] = H_NOP,
+				[RET] = H_BR,	   [SXTW] = H_SXTW,	  [SXTB] = H_SXTB,
+				[SXTH] = H_SXTH,   [UXTB] = H_UXTB,	  [UXTH] = H_UXTH,
+				[UXTW] = H_UXTW,
+			};
+
+			d->handler = handlers[ins->type];
+			d->rd = destinationRegister(r->rd);
+			d->rn = sourceRegister(r->rn);
+			d->rm = sourceRegister(r->rm);
+
+			if (ins->type == LSL || ins->type == LSR || ins->type == ASR) {
+				if (r->shamt != NULL)
+					d->imm = immediateValue(r->shamt) & 63;
+				else
+					d->handler += H_LSLV - H_LSL;
+			}
+			break;
+		}
+
+		case I_TYPE: {
+			static const uint8_t handlers[NUM_INSTRUCTIONS] = {
+				[ADDI] = H_ADDI, [ADDIS] = H_ADDIS, [SUBI] = H_SUBI,
+				[SUBIS] = H_SUBIS, [ANDI] = H_ANDI,	[ORRI] = H_ORRI,
+				[EORI] = H_EORI, [CMPI] = H_SUBIS,
+			};
+
+			d->handler = handlers[ins->type];
+			d->rd = destinationRegister(ins->values.I.rd);
+			d->rn = sourceRegister(ins->values.I.rn);
+			d->imm = immediateValue(ins->values.I.imm12);
+			break;
+		}
+
+		case D_TYPE: {
+			static const uint8_t handlers[NUM_INSTRUCTIONS] = {
+				[LDUR] = H_LDUR,   [LDURB] = H_LDURB, [LDURH] = H_LDURH,
+				[LDURSW] = H_LDURSW, [STUR] = H_STUR, [STURB] = H_STURB,
+				[STURH] = H_STURH,
+			};
+
+			d->handler = handlers[ins->type];
+			d->rn = sourceRegister(ins->values.D.rn);
+			d->imm = immediateValue(ins->values.D.addr9);
+			if (isLoad(*ins))
+				d->rd = destinationRegister(ins->values.D.rt);
+			else
+				d->rm = sourceRegister(ins->values.D.rt);
+			break;
+		}
+
+		case B_TYPE:
+			if (ins->type == BR) {
+				d->handler = H_BR;
+				d->rn = sourceRegister(ins->values.B.rn);
+			} else if (ins->type == B || ins->type == BL) {
+				d->handler = ins->type == B ? H_B : H_BL;
+			} else {
+				d->handler = H_BCOND;
+				d->rm = (uint8_t)(ins->type - B_EQ + COND_EQ);
+			}
+			break;
+
+		case CB_TYPE:
+			d->handler = ins->type == CBZ ? H_CBZ : H_CBNZ;
+			d->rn = sourceRegister(ins->values.CB.rt);
+			break;
+
+		case IM_TYPE: {
+			const IMVals *im = &ins->values.IM;
+			unsigned shift = (unsigned)immediateValue(im->sh) & 48;
+			uint64_t imm = (uint64_t)immediateValue(im->imm16) & 0xFFFF;
+
+			d->rd = destinationRegister(im->rd);
+			d->rn = sourceRegister(im->rn);
+			d->rm = (uint8_t)shift;
+
+			if (ins->type == MOVZ) {
+				d->handler = H_MOVI;
+				d->imm = (int64_t)(imm << shift);
+			} else if (ins->type == MOVN) {
+				d->handler = H_MOVI;
+				d->imm = (int64_t)~(imm << shift);
+			} else if (ins->type == MOVK) {
+				d->handler = H_MOVK;
+				d->imm = (int64_t)(imm << shift);
+				d->rn = sourceRegister(im->rd);
+			} else if (im->rn != REG_NONE) {
+				d->handler = H_MOVR;
+			} else {
+				d->handler = H_MOVI;
+				d->imm = immediateValue(im->imm16);
+			}
+			break;
+		}
+
+		default:
+			break;
+		}
+	}
+
+	memset(&code[count], 0, sizeof code[count]);
+	code[count].handler = H_HALT;
+	code[count].target = count;
+
+	return code;
+}
+
+// }}}
+
+// {{{ Execute Program
+
+// Threaded interpreter over the pre-decoded program. Each handler ends by
+// jumping straight to the next instruction's handler (computed goto on GCC
+// and Clang, a switch elsewhere). Runs until `capacity` instructions have
+// retired, the program halts or `max_steps` is reached; retired instructions
+// are written to `retired` and their count returned. Loads and stores also
+// write their effective address to the same slot of `addresses`.
+size_t executeProgram(Machine *machine, const DecodedInstruction *code,
+					  uint32_t program_size, uint32_t *retired,
+					  uint64_t *addresses, size_t capacity,
+					  uint64_t max_steps) {
+	int64_t *x = machine->x;
+	SparseMemory *memory = &machine->memory;
+	uint8_t n = machine->n, z = machine->z, c = machine->c, v = machine->v;
+	uint32_t pc = machine->pc < program_size ? (uint32_t)machine->pc
+											 : program_size;
+	size_t count = 0;
+	size_t limit = capacity;
+	const DecodedInstruction *d;
+
+	if (max_steps - machine->steps < limit)
+		limit = (size_t)(max_steps - machine->steps);
+	if (machine->steps >= max_steps)
+		limit = 0;
+
+#define RD x[d->rd]
+#define RN ((uint64_t)x[d->rn])
+#define RM ((uint64_t)x[d->rm])
+#define FLAGS_NZ(r)                                                            \
+	do {                                                                       \
+		n = (int64_t)(r) < 0;                                                  \
+		z = (r) == 0;                                                          \
+	} while (0)
+#define FLAGS_ADD(a, b, r)                                                     \
+	do {                                                                       \
+		FLAGS_NZ(r);                                                           \
+		c = (r) < (a);                                                         \
+		v = (int64_t)(((a) ^ (r)) & ((b) ^ (r))) < 0;                          \
+	} while (0)
+#define FLAGS_SUB(a, b, r)                                                     \
+	do {                                                                       \
+		FLAGS_NZ(r);                                                           \
+		c = (a) >= (b);                                                        \
+		v = (int64_t)(((a) ^ (b)) & ((a) ^ (r))) < 0;                          \
+	} while (0)
+#define RETIRE() retired[count++] = pc
+#define RETIRE_ACCESS(address)                                                 \
+	do {                                                                       \
+		addresses[count] = (address);                                          \
+		retired[count++] = pc;                                                 \
+	} while (0)
+#define RETIRE_TAKEN() retired[count++] = pc | RETIRED_TAKEN
+#define INDIRECT(address)                                                      \
+	((address) / 4 < program_size ? (uint32_t)((address) / 4) : program_size)
+
+#if defined(__GNUC__)
+#define HANDLER_LABEL(name) &&L_##name,
+	static void *const labels[NUM_HANDLERS] = {HANDLER_TABLE(HANDLER_LABEL)};
+#undef HANDLER_LABEL
+#define CASE(name) L_##name:
+#define NEXT(next_pc)                                                          \
+	do {                                                                       \
+		pc = (next_pc);                                                        \
+		if (count == limit)                                                    \
+			goto done;                                                         \
+		d = &code[pc];                                                         \
+		goto *labels[d->handler];                                              \
+	} while (0)
+
+	NEXT(pc);
+	{
+#else
+#define CASE(name) case name:
+#define NEXT(next_pc)                                                          \
+	do {                                                                       \
+		pc = (next_pc);                                                        \
+		goto dispatch;                                                         \
+	} while (0)
+
+dispatch:
+	if (count == limit)
+		goto done;
+	d = &code[pc];
+	switch (d->handler) {
+#endif
+
+		CASE(H_ADD) {
+			RD = (int64_t)(RN + RM);
+			RETIRE();
+			NEXT(pc + 1);
+		}
+		CASE(H_ADDS) {
+			uint64_t a = RN, b = RM, r = a + b;
+			FLAGS_ADD(a, b, r);
+			RD = (int64_t)r;
+			RETIRE();
+			NEXT(pc + 1);
+		}
+		CASE(H_SUB) {
+			RD = (int64_t)(RN - RM);
+			RETIRE();
+			NEXT(pc + 1);
+		}
+		CASE(H_SUBS) {
+			uint64_t a = RN, b = RM, r = a - b;
+			FLAGS_SUB(a, b, r);
+			RD = (int64_t)r;
+			RETIRE();
+			NEXT(pc + 1);
+		}
+		CASE(H_AND) {
+			RD = (int64_t)(RN & RM);
+			RETIRE();
+			NEXT(pc + 1);
+		}
+		CASE(H_ANDS) {
+			uint64_t r = RN & RM;
+			FLAGS_NZ(r);
+			c = v = 0;
+			RD = (int64_t)r;
+			RETIRE();
+			NEXT(pc + 1);
+		}
+		CASE(H_ORR) {
+			RD = (int64_t)(RN | RM);
+			RETIRE();
+			NEXT(pc + 1);
+		}
+		CASE(H_EOR) {
+			RD = (int64_t)(RN ^ RM);
+			RETIRE();
+			NEXT(pc + 1);
+		}
+		CASE(H_LSL) {
+			RD = (int64_t)(RN << d->imm);
+			RETIRE();
+			NEXT(pc + 1);
+		}
+		CASE(H_LSR) {
+			RD = (int64_t)(RN >> d->imm);
+			RETIRE();
+			NEXT(pc + 1);
+		}
+		CASE(H_ASR) {
+			RD = (int64_t)RN >> d->imm;
+			RETIRE();
+			NEXT(pc + 1);
+		}
+		CASE(H_LSLV) {
+			RD = (int64_t)(RN << (RM & 63));
+			RETIRE();
+			NEXT(pc + 1);
+		}
+		CASE(H_LSRV) {
+			RD = (int64_t)(RN >> (RM & 63));
+			RETIRE();
+			NEXT(pc + 1);
+		}
+		CASE(H_ASRV) {
+			RD = (int64_t)RN >> (RM & 63);
+			RETIRE();
+			NEXT(pc + 1);
+		}
+		CASE(H_MUL) {
+			RD = (int64_t)(RN * RM);
+			RETIRE();
+			NEXT(pc + 1);
+		}
+		CASE(H_UMULH) {
+			RD = (int64_t)(((unsigned __int128)RN * RM) >> 64);
+			RETIRE();
+			NEXT(pc + 1);
+		}
+		CASE(H_SMULH) {
+			RD = (int64_t)(((__int128)(int64_t)RN * (int64_t)RM) >> 64);
+			RETIRE();
+			NEXT(pc + 1);
+		}
+		CASE(H_UDIV) {
+			uint64_t b = RM;
+			RD = b != 0 ? (int64_t)(RN / b) : 0;
+			RETIRE();
+			NEXT(pc + 1);
+		}
+		CASE(H_SDIV) {
+			int64_t a = (int64_t)RN, b = (int64_t)RM;
+			RD = b == 0 ? 0 : (a == INT64_MIN && b == -1) ? a : a / b;
+			RETIRE();
+			NEXT(pc + 1);
+		}
+		CASE(H_ADDI) {
+			RD = (int64_t)(RN + (uint64_t)d->imm);
+			RETIRE();
+			NEXT(pc + 1);
+		}
+		CASE(H_ADDIS) {
+			uint64_t a = RN, b = (uint64_t)d->imm, r = a + b;
+			FLAGS_ADD(a, b, r);
+			RD = (int64_t)r;
+			RETIRE();
+			NEXT(pc + 1);
+		}
+		CASE(H_SUBI) {
+			RD = (int64_t)(RN - (uint64_t)d->imm);
+			RETIRE();
+			NEXT(pc + 1);
+		}
+		CASE(H_SUBIS) {
+			uint64_t a = RN, b = (uint64_t)d->imm, r = a - b;
+			FLAGS_SUB(a, b, r);
+			RD = (int64_t)r;
+			RETIRE();
+			NEXT(pc + 1);
+		}
+		CASE(H_ANDI) {
+			RD = (int64_t)(RN & (uint64_t)d->imm);
+			RETIRE();
+			NEXT(pc + 1);
+		}
+		CASE(H_ORRI) {
+			RD = (int64_t)(RN | (uint64_t)d->imm);
+			RETIRE();
+			NEXT(pc + 1);
+		}
+		CASE(H_EORI) {
+			RD = (int64_t)(RN ^ (uint64_t)d->imm);
+			RETIRE();
+			NEXT(pc + 1);
+		}
+		CASE(H_LDUR) {
+			uint64_t address = RN + (uint64_t)d->imm;
+			RD = (int64_t)memoryRead(memory, address, 8);
+			RETIRE_ACCESS(address);
+			NEXT(pc + 1);
+		}
+		CASE(H_LDURB) {
+			uint64_t address = RN + (uint64_t)d->imm;
+			RD = (int64_t)memoryRead(memory, address, 1);
+			RETIRE_ACCESS(address);
+			NEXT(pc + 1);
+		}
+		CASE(H_LDURH) {
+			uint64_t address = RN + (uint64_t)d->imm;
+			RD = (int64_t)memoryRead(memory, address, 2);
+			RETIRE_ACCESS(address);
+			NEXT(pc + 1);
+		}
+		CASE(H_LDURSW) {
+			uint64_t address = RN + (uint64_t)d->imm;
+			RD = (int64_t)(int32_t)memoryRead(memory, address, 4);
+			RETIRE_ACCESS(address);
+			NEXT(pc + 1);
+		}
+		CASE(H_STUR) {
+			uint64_t address = RN + (uint64_t)d->imm;
+			memoryWrite(memory, address, RM, 8);
+			RETIRE_ACCESS(address);
+			NEXT(pc + 1);
+		}
+		CASE(H_STURB) {
+			uint64_t address = RN + (uint64_t)d->imm;
+			memoryWrite(memory, address, RM, 1);
+			RETIRE_ACCESS(address);
+			NEXT(pc + 1);
+		}
+		CASE(H_STURH) {
+			uint64_t address = RN + (uint64_t)d->imm;
+			memoryWrite(memory, address, RM, 2);
+			RETIRE_ACCESS(address);
+			NEXT(pc + 1);
+		}
+		CASE(H_MOVI) {
+			RD = d->imm;
+			RETIRE();
+			NEXT(pc + 1);
+		}
+		CASE(H_MOVK) {
+			RD = (int64_t)((RN & ~(0xFFFFull << d->rm)) | (uint64_t)d->imm);
+			RETIRE();
+			NEXT(pc + 1);
+		}
+		CASE(H_MOVR) {
+			RD = (int64_t)RN;
+			RETIRE();
+			NEXT(pc + 1);
+		}
+		CASE(H_SXTW) {
+			RD = (int64_t)(int32_t)RN;
+			RETIRE();
+			NEXT(pc + 1);
+		}
+		CASE(H_SXTB) {
+			RD = (int64_t)(int8_t)RN;
+			RETIRE();
+			NEXT(pc + 1);
+		}
+		CASE(H_SXTH) {
+			RD = (int64_t)(int16_t)RN;
+			RETIRE();
+			NEXT(pc + 1);
+		}
+		CASE(H_UXTB) {
+			RD = (int64_t)(RN & 0xFF);
+			RETIRE();
+			NEXT(pc + 1);
+		}
+		CASE(H_UXTH) {
+			RD = (int64_t)(RN & 0xFFFF);
+			RETIRE();
+			NEXT(pc + 1);
+		}
+		CASE(H_UXTW) {
+			RD = (int64_t)(RN & 0xFFFFFFFF);
+			RETIRE();
+			NEXT(pc + 1);
+		}
+		CASE(H_B) {
+			RETIRE_TAKEN();
+			NEXT(d->target);
+		}
+		CASE(H_BL) {
+			x[REG_LR] = (int64_t)(pc + 1) * 4;
+			RETIRE_TAKEN();
+			NEXT(d->target);
+		}
+		CASE(H_BR) {
+			uint64_t address = RN;
+			RETIRE_TAKEN();
+			NEXT(INDIRECT(address));
+		}
+		CASE(H_CBZ) {
+			if (RN == 0) {
+				RETIRE_TAKEN();
+				NEXT(d->target);
+			}
+			RETIRE();
+			NEXT(pc + 1);
+		}
+		CASE(H_CBNZ) {
+			if (RN != 0) {
+				RETIRE_TAKEN();
+				NEXT(d->target);
+			}
+			RETIRE();
+			NEXT(pc + 1);
+		}
+		CASE(H_BCOND) {
+			int holds = 0;
+			switch (d->rm) {
+			case COND_EQ:
+				holds = z;
+				break;
+			case COND_NE:
+				holds = !z;
+				break;
+			case COND_GT:
+				holds = !z && n == v;
+				break;
+			case COND_LT:
+				holds = n != v;
+				break;
+			case COND_GE:
+				holds = n == v;
+				break;
+			case COND_LE:
+				holds = z || n != v;
+				break;
+			}
+			if (holds) {
+				RETIRE_TAKEN();
+				NEXT(d->target);
+			}
+			RETIRE();
+			NEXT(pc + 1);
+		}
+		CASE(H_NOP) {
+			RETIRE();
+			NEXT(pc + 1);
+		}
+		CASE(H_HALT) {
+			machine->halted = 1;
+			goto done;
+		}
+	}
+
+done:
+	machine->n = n;
+	machine->z = z;
+	machine->c = c;
+	machine->v = v;
+	machine->pc = pc;
+	machine->steps += count;
+	x[REG_XZR] = 0;
+	return count;
+
+#undef RD
+#undef RN
+#undef RM
+#undef FLAGS_NZ
+#undef FLAGS_ADD
+#undef FLAGS_SUB
+#undef RETIRE
+#undef RETIRE_ACCESS
+#undef RETIRE_TAKEN
+#undef INDIRECT
+#undef CASE
+#undef NEXT
+}
+
+// }}}
+
+/*
+ *  Output
+ */
+
+// {{{ Output Buffer
+
+// Large reports are assembled in one buffer and written with a single fwrite
+// per megabyte instead of one printf per column
+typedef struct {
+	FILE *file;
+	char *data;
+	size_t used, capacity;
+} OutputBuffer;
+
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+
+void outputInit(OutputBuffer *out, FILE *file) {
+	out->file = file;
+	out->capacity = OUTPUT_BUFFER_SIZE;
+	out->used = 0;
+	out->data = malloc(out->capacity);
+}
+
+void outputFlush(OutputBuffer *out) {
+	if (out->used > 0)
+		fwrite(out->data, 1, out->used, out->file);
+	out->used = 0;
+}
+
+void outputFree(OutputBuffer *out) {
+	outputFlush(out);
+	free(out->data);
+	out->data = NULL;
+}
+
+void outputWrite(OutputBuffer *out, const char *text, size_t length) {
+	while (length > 0) {
+		if (out->used == out->capacity)
+			outputFlush(out);
+
+		size_t chunk = out->capacity - out->used;
+		if (chunk > length)
+			chunk = length;
+
+		memcpy(out->data + out->used, text, chunk);
+		out->used += chunk;
+		text += chunk;
+		length -= chunk;
+	}
+}
+
+static inline void outputString(OutputBuffer *out, const char *text) {
+	outputWrite(out, text, strlen(text));
+}
+
+// Appends `count` copies of `c`
+void outputRepeat(OutputBuffer *out, char c, uint64_t count) {
+	while (count > 0) {
+		if (out->used == out->capacity)
+			outputFlush(out);
+
+		size_t chunk = out->capacity - out->used;
+		if (chunk > count)
+			chunk = (size_t)count;
+
+		memset(out->data + out->used, c, chunk);
+		out->used += chunk;
+		count -= chunk;
+	}
+}
+
+// Appends `value` in decimal, right-aligned to at least `width` characters
+void outputUnsigned(OutputBuffer *out, uint64_t value, int width) {
+	char digits[24];
+	int n = 0;
+
+	do {
+		digits[sizeof digits - 1 - n++] = (char)('0' + value % 10);
+		value /= 10;
+	} while (value != 0);
+
+	if (width > n)
+		outputRepeat(out, ' ', (uint64_t)(width - n));
+	outputWrite(out, digits + sizeof digits - n, (size_t)n);
+}
+
+// }}}
+
+// {{{ Timeline Export
+
+// Streams one row per analysed instruction as it is produced, so exports of
+// multi-million instruction runs never hold the document in memory
+typedef enum {
+	EXPORT_NONE,
+	EXPORT_CSV,
+	EXPORT_JSONL,
+	EXPORT_CHROME,
+	NUM_EXPORT_FORMATS
+} ExportFormat;
+
+const char *export_format_names[NUM_EXPORT_FORMATS] = {
+	[EXPORT_NONE] = "none",
+	[EXPORT_CSV] = "csv",
+	[EXPORT_JSONL] = "jsonl",
+	[EXPORT_CHROME] = "chrome",
+};
+
+#define EXPORT_TRACKS 64
+
+// track_end holds the cycle each Chrome trace track is free again
+typedef struct {
+	ExportFormat format;
+	OutputBuffer out;
+	uint64_t rows;
+	uint64_t track_end[EXPORT_TRACKS];
+} TimelineExporter;
+
+static const char *stage_names[5] = {"IF", "ID", "EX", "ME", "WB"};
+
+// Cycle in which the instruction enters each of IF, ID, EX, ME and WB
+static void stageCycles(const InstructionTiming *timing, uint64_t cycles[5]) {
+	for (int stage = 0; stage < 5; stage++)
+		cycles[stage] = timing->issue_cycle + (uint64_t)stage;
+	cycles[2] += timing->queue_cycles;
+	cycles[3] += timing->queue_cycles + (uint64_t)timing->execute_extra;
+	cycles[4] += timing->queue_cycles + (uint64_t)timing->execute_extra +
+				 timing->memory_stalls + timing->retire_cycles;
+}
+
+int parseExportFormat(const char *name) {
+	for (int i = 1; i < NUM_EXPORT_FORMATS; i++)
+		if (strcmp(name, export_format_names[i]) == 0)
+			return i;
+	return -1;
+}
+
+void exporterBegin(TimelineExporter *exporter, ExportFormat format,
+				   FILE *file) {
+	exporter->format = format;
+	exporter->rows = 0;
+	memset(exporter->track_end, 0, sizeof exporter->track_end);
+	outputInit(&exporter->out, file);
+
+	if (format == EXPORT_CSV)
+		outputString(&exporter->out, "row,index,op,if,id,ex,me,wb,stalls,"
+									 "control_stalls,memory_stalls,reason\n");
+	else if (format == EXPORT_CHROME)
+		outputString(&exporter->out, "{\"displayTimeUnit\":\"ns\","
+									 "\"traceEvents\":[\n");
+}
+
+// One instruction of a Chrome trace: a span covering IF..WB with a nested
+// event per stage. Cycles are written as microseconds. Each row goes on the
+// first track that is free when it issues, so rows only share a track when
+// more than EXPORT_TRACKS are in flight (then the earliest free one is used).
+static void exportChromeRow(TimelineExporter *exporter, uint32_t index,
+							const char *op, const InstructionTiming *timing,
+							const uint64_t cycles[5]) {
+	OutputBuffer *out = &exporter->out;
+	uint64_t track = 0;
+
+	for (uint64_t k = 0; k < EXPORT_TRACKS; k++) {
+		if (exporter->track_end[k] <= cycles[0]) {
+			track = k;
+			break;
+		}
+		if (exporter->track_end[k] < exporter->track_end[track])
+			track = k;
+	}
+	exporter->track_end[track] = cycles[4] + 1;
+
+	outputString(out, exporter->rows == 0 ? "" : ",\n");
+	outputString(out, "{\"name\":\"");
+	outputString(out, op);
+	outputString(out, "\",\"ph\":\"X\",\"pid\":1,\"tid\":");
+	outputUnsigned(out, track, 0);
+	outputString(out, ",\"ts\":");
+	outputUnsigned(out, cycles[0], 0);
+	outputString(out, ",\"dur\":");
+	outputUnsigned(out, cycles[4] + 1 - cycles[0], 0);
+	outputString(out, ",\"args\":{\"row\":");
+	outputUnsigned(out, exporter->rows, 0);
+	outputString(out, ",\"index\":");
+	outputUnsigned(out, index, 0);
+	outputString(out, ",\"stalls\":");
+	outputUnsigned(out, timing->stalls, 0);
+	outputString(out, ",\"control_stalls\":");
+	outputUnsigned(out, timing->control_stalls, 0);
+	outputString(out, ",\"memory_stalls\":");
+	outputUnsigned(out, timing->memory_stalls, 0);
+	outputString(out, ",\"reason\":\"");
+	outputString(out, hazard_names[timing->reason]);
+	outputString(out, "\"}}");
+
+	for (int stage = 0; stage < 5; stage++) {
+		outputString(out, ",\n{\"name\":\"");
+		outputString(out, stage_names[stage]);
+		outputString(out, "\",\"ph\":\"X\",\"pid\":1,\"tid\":");
+		outputUnsigned(out, track, 0);
+		outputString(out, ",\"ts\":");
+		outputUnsigned(out, cycles[stage], 0);
+		outputString(out, ",\"dur\":");
+		outputUnsigned(out, stage < 4 ? cycles[stage + 1] - cycles[stage] : 1,
+					   0);
+		outputWrite(out, "}", 1);
+	}
+}
+
+void exporterRow(TimelineExporter *exporter, uint32_t index,
+				 const Instruction *ins, const InstructionTiming *timing) {
+	OutputBuffer *out = &exporter->out;
+	const char *op = ins->type < NUM_INSTRUCTIONS
+						 ? instruction_mnemonics[ins->type]
+						 : "?";
+	uint64_t cycles[5];
+
+	stageCycles(timing, cycles);
+
+	switch (exporter->format) {
+
+	case EXPORT_CSV:
+		outputUnsigned(out, exporter->rows, 0);
+		outputWrite(out, ",", 1);
+		outputUnsigned(out, index, 0);
+		outputWrite(out, ",", 1);
+		outputString(out, op);
+		for (int stage = 0; stage < 5; stage++) {
+			outputWrite(out, ",", 1);
+			outputUnsigned(out, cycles[stage], 0);
+		}
+		outputWrite(out, ",", 1);
+		outputUnsigned(out, timing->stalls, 0);
+		outputWrite(out, ",", 1);
+		outputUnsigned(out, timing->control_stalls, 0);
+		outputWrite(out, ",", 1);
+		outputUnsigned(out, timing->memory_stalls, 0);
+		outputWrite(out, ",", 1);
+		outputString(out, hazard_names[timing->reason]);
+		outputWrite(out, "\n", 1);
+		break;
+
+	case EXPORT_JSONL:
+		outputString(out, "{\"row\":");
+		outputUnsigned(out, exporter->rows, 0);
+		outputString(out, ",\"index\":");
+		outputUnsigned(out, index, 0);
+		outputString(out, ",\"op\":\"");
+		outputString(out, op);
+		outputWrite(out, "\"", 1);
+		for (int stage = 0; stage < 5; stage++) {
+			outputString(out, ",\"");
+			outputString(out, stage_names[stage]);
+			outputString(out, "\":");
+			outputUnsigned(out, cycles[stage], 0);
+		}
+		outputString(out, ",\"stalls\":");
+		outputUnsigned(out, timing->stalls, 0);
+		outputString(out, ",\"control_stalls\":");
+		outputUnsigned(out, timing->control_stalls, 0);
+		outputString(out, ",\"memory_stalls\":");
+		outputUnsigned(out, timing->memory_stalls, 0);
+		outputString(out, ",\"reason\":\"");
+		outputString(out, hazard_names[timing->reason]);
+		outputString(out, "\"}\n");
+		break;
+
+	case EXPORT_CHROME:
+		exportChromeRow(exporter, index, op, timing, cycles);
+		break;
+
+	default:
+		break;
+	}
+
+	exporter->rows++;
+}
+
+void exporterEnd(TimelineExporter *exporter) {
+	if (exporter->format == EXPORT_CHROME)
+		outputString(&exporter->out, "\n]}\n");
+	outputFree(&exporter->out);
+}
+
+// }}}
+
+/*
+ *  Program Analysis
+ */
+
+// {{{ Block Memo
+
+// Loops retire the same basic blocks over and over, nearly always from a
+// handful of pipeline states, so an executed run times each pair of block
+// and entry state once and replays it from then on. A block runs from its
+// first pc up to and including the next branch (at most BLOCK_MAX_LENGTH
+// instructions), so a pc and a length always name the same instructions.
+//
+// The entry state is what hazardEngineEquivalent compares, written relative
+// to next_issue. From an equivalent state a block has the same stalls, moves
+// next_issue by the same amount and leaves an equivalent state behind, which
+// is stored the same way. Learning predictors, the data cache and the
+// out-of-order core keep state outside of that, so with any of them every
+// instruction is stepped.
+#define BLOCK_MAX_LENGTH 64
+#define BLOCK_MEMO_ENTRIES (1 << 16)
+// Lookups after which a memo that rarely hits is switched off
+#define BLOCK_MEMO_TRIAL 8192
+#define BLOCK_STATE_HEADER (3 + (NUM_UNITS + 3) / 4)
+#define BLOCK_STATE_WORDS (BLOCK_STATE_HEADER + NUM_REGISTERS)
+
+// key is the block word (pc, length, taken) followed by the entry state.
+// rows are only kept when the caller needs per-instruction timings, with
+// cycles relative to the entry next_issue like advance and finish.
+typedef struct {
+	uint64_t hash;
+	const uint64_t *key;
+	const uint64_t *exit;
+	InstructionTiming *rows;
+	uint64_t advance, finish;
+	uint64_t stalls, stalls_by_reason[NUM_HAZARDS];
+	uint32_t branches, mispredictions;
+	uint8_t key_words, exit_words;
+} BlockMemoEntry;
+
+// slots[] holds entry indices plus one, 0 marks an empty slot
+typedef struct {
+	int enabled;
+	int keep_rows;
+	uint8_t *lengths;
+	BlockMemoEntry *entries;
+	uint32_t count, capacity;
+	uint32_t *slots;
+	uint64_t lookups, hits;
+	Arena arena;
+} BlockMemo;
+
+void blockMemoInit(BlockMemo *memo, const Inputs *inputs,
+				   const PipelineConfig *config, int keep_rows) {
+	memset(memo, 0, sizeof *memo);
+	memo->enabled = !config->out_of_order && config->cache.size == 0 &&
+					config->branch_policy < BRANCH_ONE_BIT;
+	if (!memo->enabled)
+		return;
+
+	memo->keep_rows = keep_rows;
+	memo->slots = calloc(2 * BLOCK_MEMO_ENTRIES, sizeof(uint32_t));
+
+	// Block length from every pc, counted back from the end
+	memo->lengths = malloc(inputs->instructions_count + 1);
+	memo->lengths[inputs->instructions_count] = 0;
+	for (int pc = inputs->instructions_count - 1; pc >= 0; pc--) {
+		uint8_t next = memo->lengths[pc + 1];
+
+		memo->lengths[pc] =
+			isBranch(inputs->instructions[pc]) || next == BLOCK_MAX_LENGTH
+				? 1
+				: next + 1;
+	}
+}
+
+void blockMemoFree(BlockMemo *memo) {
+	free(memo->lengths);
+	free(memo->entries);
+	free(memo->slots);
+	arenaFree(&memo->arena);
+	memset(memo, 0, sizeof *memo);
+}
+
+// Writes the state of `engine` relative to its next_issue and returns the
+// number of words, or 0 if a cycle is too far out to be packed. Group ports
+// take a byte each above group_writes, units 16 bits each, and every
+// register still on its way to the register file one word.
+static int hazardEngineState(const HazardEngine *engine, uint64_t *words) {
+	uint64_t base = engine->next_issue;
+	uint32_t pending = 0;
+	int count = BLOCK_STATE_HEADER;
+
+	memset(words, 0, BLOCK_STATE_HEADER * sizeof(uint64_t));
+	words[0] = engine->pending_control_stalls;
+	if (engine->group_size != 0 && base == engine->group_cycle) {
+		words[0] |= (uint64_t)engine->group_size << 32;
+		words[1] = engine->group_writes;
+		for (int port = 0; port < NUM_PORTS; port++)
+			words[1] |= (uint64_t)engine->group_ports[port] << (32 + 8 * port);
+	}
+
+	for (int unit = 0; unit < NUM_UNITS; unit++) {
+		if (engine->unit_free[unit] <= base + 2)
+			continue;
+
+		uint64_t busy = engine->unit_free[unit] - base - 2;
+		if (busy > 0xFFFF)
+			return 0;
+		words[3 + unit / 4] |= busy << (16 * (unit % 4));
+	}
+
+	// A register written from the register file later than ID is pending;
+	// its producer is at most one cycle before next_issue
+	for (int r = 0; r < NUM_REGISTERS; r++) {
+		if (engine->register_file_ex[r] <= base + 2)
+			continue;
+
+		uint64_t producer = engine->producer_ex[r] + 1 - base;
+		uint64_t file = engine->register_file_ex[r] - base;
+		if (producer > 0xFFFF || file > 0xFFFF)
+			return 0;
+		pending |= 1u << r;
+		words[count++] = producer | file << 16 |
+						 (uint64_t)engine->forward_offsets[r] << 32;
+	}
+	words[2] = pending | (uint64_t)(engine->load_writers & pending) << 32;
+	return count;
+}
+
+// Inverse of hazardEngineState with next_issue at `base`. Values that are
+// not stored can no longer stall anything, so they are cleared.
+static void hazardEngineRestore(HazardEngine *engine, const uint64_t *words,
+								uint64_t base) {
+	uint32_t pending = (uint32_t)words[2];
+	int count = BLOCK_STATE_HEADER;
+
+	engine->next_issue = base;
+	engine->pending_control_stalls = (uint32_t)words[0];
+	engine->group_cycle = base;
+	engine->group_size = (uint8_t)(words[0] >> 32);
+	engine->group_writes = (uint32_t)words[1];
+	for (int port = 0; port < NUM_PORTS; port++)
+		engine->group_ports[port] = (uint8_t)(words[1] >> (32 + 8 * port));
+
+	for (int unit = 0; unit < NUM_UNITS; unit++) {
+		uint64_t busy = (words[3 + unit / 4] >> (16 * (unit % 4))) & 0xFFFF;
+		engine->unit_free[unit] = busy != 0 ? base + 2 + busy : 0;
+	}
+
+	memset(engine->producer_ex, 0, sizeof engine->producer_ex);
+	memset(engine->register_file_ex, 0, sizeof engine->register_file_ex);
+	for (uint32_t regs = pending; regs != 0; regs &= regs - 1) {
+		int r = __builtin_ctz(regs);
+		uint64_t word = words[count++];
+
+		engine->producer_ex[r] = base + (word & 0xFFFF) - 1;
+		engine->register_file_ex[r] = base + ((word >> 16) & 0xFFFF);
+		engine->forward_offsets[r] = (uint8_t)(word >> 32);
+	}
+	engine->load_writers = (uint32_t)(words[2] >> 32);
+}
+
+static uint64_t blockHash(const uint64_t *words, int count) {
+	uint64_t hash = 0;
+
+	for (int i = 0; i < count; i++)
+		hash = (hash ^ words[i]) * 0x9E3779B97F4A7C15ull;
+	return hash ^ hash >> 29;
+}
+
+// Saves a block just timed from `key`; `engine` is in its exit state and
+// rows[] hold absolute cycles from `base`
+static void blockMemoInsert(BlockMemo *memo, const uint64_t *key, int words,
+							uint64_t hash, uint32_t slot,
+							const HazardEngine *engine, uint64_t base,
+							const InstructionTiming *rows, uint32_t length,
+							uint64_t finish, uint32_t branches,
+							uint32_t mispredictions) {
+	uint64_t exit[BLOCK_STATE_WORDS];
+	int exit_words = hazardEngineState(engine, exit);
+
+	if (exit_words == 0 || memo->count >= BLOCK_MEMO_ENTRIES)
+		return;
+
+	if (memo->count == memo->capacity) {
+		memo->capacity = memo->capacity != 0 ? memo->capacity * 2 : 1024;
+		memo->entries = realloc(memo->entries,
+								memo->capacity * sizeof(BlockMemoEntry));
+	}
+
+	BlockMemoEntry *entry = &memo->entries[memo->count];
+	uint64_t *stored =
+		arenaAlloc(&memo->arena, (words + exit_words) * sizeof(uint64_t));
+
+	memset(entry, 0, sizeof *entry);
+	memcpy(stored, key, words * sizeof(uint64_t));
+	memcpy(stored + words, exit, exit_words * sizeof(uint64_t));
+	entry->hash = hash;
+	entry->key = stored;
+	entry->exit = stored + words;
+	entry->key_words = (uint8_t)words;
+	entry->exit_words = (uint8_t)exit_words;
+	entry->advance = engine->next_issue - base;
+	entry->finish = finish > base ? finish - base : 0;
+	entry->branches = branches;
+	entry->mispredictions = mispredictions;
+
+	for (uint32_t k = 0; k < length; k++) {
+		const InstructionTiming *timing = &rows[k];
+
+		entry->stalls += timing->stalls + timing->control_stalls;
+		entry->stalls_by_reason[timing->reason] += timing->stalls;
+		entry->stalls_by_reason[HAZARD_BRANCH] += timing->control_stalls;
+	}
+
+	if (memo->keep_rows) {
+		entry->rows =
+			arenaAlloc(&memo->arena, length * sizeof(InstructionTiming));
+		for (uint32_t k = 0; k < length; k++) {
+			entry->rows[k] = rows[k];
+			entry->rows[k].issue_cycle -= base;
+		}
+	}
+
+	memo->slots[slot] = ++memo->count;
+}
+
+// Times the block of `length` retired instructions at retired[0], replaying
+// it when this block was seen from an equivalent state before. Returns that
+// entry, or NULL if the block was stepped. rows[] get absolute timings unless
+// the block was replayed without keep_rows.
+const BlockMemoEntry *blockMemoTime(BlockMemo *memo, HazardEngine *engine,
+									const Inputs *inputs,
+									const uint32_t *retired, uint32_t length,
+									InstructionTiming *rows) {
+	uint64_t key[1 + BLOCK_STATE_WORDS];
+	uint32_t pc = retired[0] & ~RETIRED_TAKEN;
+	uint64_t base = engine->next_issue;
+	int words = hazardEngineState(engine, key + 1);
+	uint32_t slot = 0;
+	uint64_t hash = 0;
+
+	if (words != 0) {
+		uint32_t mask = 2 * BLOCK_MEMO_ENTRIES - 1;
+
+		key[0] = pc | (uint64_t)length << 32 |
+				 (uint64_t)((retired[length - 1] & RETIRED_TAKEN) != 0) << 48;
+		words++;
+		hash = blockHash(key, words);
+		memo->lookups++;
+
+		for (slot = (uint32_t)hash & mask; memo->slots[slot] != 0;
+			 slot = (slot + 1) & mask) {
+			const BlockMemoEntry *entry = &memo->entries[memo->slots[slot] - 1];
+
+			if (entry->hash != hash || entry->key_words != words ||
+				memcmp(entry->key, key, words * sizeof(uint64_t)) != 0)
+				continue;
+
+			hazardEngineRestore(engine, entry->exit, base + entry->advance);
+			if (entry->finish != 0 && base + entry->finish > engine->finish)
+				engine->finish = base + entry->finish;
+			engine->branches += entry->branches;
+			engine->mispredictions += entry->mispredictions;
+
+			if (memo->keep_rows)
+				for (uint32_t k = 0; k < length; k++) {
+					rows[k] = entry->rows[k];
+					rows[k].issue_cycle += base;
+				}
+			memo->hits++;
+			return entry;
+		}
+	}
+
+	// Step the block, keeping its own finish apart from the engine's
+	uint64_t finish = engine->finish;
+	uint64_t branches = engine->branches;
+	uint64_t mispredictions = engine->mispredictions;
+
+	engine->finish = 0;
+	for (uint32_t k = 0; k < length; k++) {
+		uint32_t index = (retired[k] & ~RETIRED_TAKEN);
+
+		rows[k] = hazardEngineStep(engine, &inputs->instructions[index], index,
+								   (retired[k] & RETIRED_TAKEN) != 0, 0);
+	}
+
+	if (words != 0)
+		blockMemoInsert(memo, key, words, hash, slot, engine, base, rows,
+						length, engine->finish,
+						(uint32_t)(engine->branches - branches),
+						(uint32_t)(engine->mispredictions - mispredictions));
+	if (finish > engine->finish)
+		engine->finish = finish;
+
+	// Traces that never repeat a state only pay for the lookups
+	if (memo->lookups >= BLOCK_MEMO_TRIAL && memo->hits < memo->lookups / 2)
+		memo->enabled = 0;
+	return NULL;
+}
+
+// }}}
+
+// {{{ Analyze Program
+
+void analysisFree(Analysis *analysis) {
+	if (analysis->owns_timings) {
+		free(analysis->timings);
+		free(analysis->indices);
+	}
+	memset(analysis, 0, sizeof *analysis);
+}
+
+static void analysisAccumulate(Analysis *analysis,
+							   const InstructionTiming *timing) {
+	analysis->stalls +=
+		timing->stalls + timing->control_stalls + timing->memory_stalls;
+	analysis->stalls_by_reason[timing->reason] += timing->stalls;
+	analysis->stalls_by_reason[HAZARD_BRANCH] += timing->control_stalls;
+	analysis->stalls_by_reason[HAZARD_MEMORY] += timing->memory_stalls;
+}
+
+static void analysisFinish(Analysis *analysis, const HazardEngine *engine) {
+	analysis->branches = engine->branches;
+	analysis->mispredictions = engine->mispredictions;
+	analysis->total_cycles = hazardEngineTotalCycles(engine);
+	analysis->valid = 1;
+}
+
+// A slice of the listing analysed on its own thread. The engine starts
+// empty `warmup` instructions before `start` so that, by `start`, it has
+// normally reached the same state as a sequential run, only with its cycles
+// counted from the warm-up instead of from the program start.
+typedef struct {
+	const Inputs *inputs;
+	InstructionTiming *timings;
+	uint32_t start, stop, warmup;
+	HazardEngine entry, engine;
+	uint64_t stalls, stalls_by_reason[NUM_HAZARDS];
+	uint64_t offset;
+} AnalysisChunk;
+
+#define ANALYSIS_WARMUP 64
+#define ANALYSIS_MIN_CHUNK 65536
+
+// Times [start, stop) from chunk->engine; rows are relative to its frame
+static void analyzeChunkRows(AnalysisChunk *chunk) {
+	const Instruction *instructions = chunk->inputs->instructions;
+
+	chunk->stalls = 0;
+	memset(chunk->stalls_by_reason, 0, sizeof chunk->stalls_by_reason);
+
+	for (uint32_t i = chunk->start; i < chunk->stop; i++) {
+		const Instruction *ins = &instructions[i];
+		InstructionTiming timing = hazardEngineStep(
+			&chunk->engine, ins, i, !isConditionalBranch(*ins), 0);
+
+		chunk->timings[i] = timing;
+		chunk->stalls += timing.stalls + timing.control_stalls;
+		chunk->stalls_by_reason[timing.reason] += timing.stalls;
+		chunk->stalls_by_reason[HAZARD_BRANCH] += timing.control_stalls;
+	}
+}
+
+static void *analyzeChunk(void *argument) {
+	AnalysisChunk *chunk = argument;
+	const Instruction *instructions = chunk->inputs->instructions;
+
+	for (uint32_t i = chunk->start - chunk->warmup; i < chunk->start; i++)
+		hazardEngineStep(&chunk->engine, &instructions[i], i,
+						 !isConditionalBranch(instructions[i]), 0);
+
+	// Warm-up rows belong to the previous chunk, which times them itself
+	chunk->engine.finish = 0;
+	chunk->entry = chunk->engine;
+	chunk->engine.branches = chunk->engine.mispredictions = 0;
+	analyzeChunkRows(chunk);
+	return NULL;
+}
+
+static void *shiftChunk(void *argument) {
+	AnalysisChunk *chunk = argument;
+
+	for (uint32_t i = chunk->start; i < chunk->stop; i++)
+		chunk->timings[i].issue_cycle += chunk->offset;
+	return NULL;
+}
+
+// Runs `work` on every chunk, one thread each
+static void forEachChunk(AnalysisChunk *chunks, unsigned count,
+						 void *(*work)(void *)) {
+	pthread_t threads[count];
+	uint8_t started[count];
+
+	// A chunk whose thread cannot be created runs on this one
+	for (unsigned k = 1; k < count; k++) {
+		started[k] = pthread_create(&threads[k], NULL, work, &chunks[k]) == 0;
+		if (!started[k])
+			work(&chunks[k]);
+	}
+	work(&chunks[0]);
+	for (unsigned k = 1; k < count; k++)
+		if (started[k])
+			pthread_join(threads[k], NULL);
+}
+
+// Analyses the listing in `count` chunks at once, then walks the chunk
+// boundaries in order. A chunk whose state after warm-up matches the previous
+// chunk's final state only needs its cycles moved; any other chunk is
+// re-timed from that final state. A prefix sum of the moves gives each chunk
+// its offset, which is applied in parallel again.
+static void analyzeProgramParallel(Analysis *analysis, Inputs *inputs,
+								   const PipelineConfig *config,
+								   unsigned count) {
+	AnalysisChunk *chunks = calloc(count, sizeof *chunks);
+	uint32_t total = (uint32_t)inputs->instructions_count;
+
+	for (unsigned k = 0; k < count; k++) {
+		AnalysisChunk *chunk = &chunks[k];
+
+		chunk->inputs = inputs;
+		chunk->timings = analysis->timings;
+		chunk->start = (uint32_t)((uint64_t)total * k / count);
+		chunk->stop = (uint32_t)((uint64_t)total * (k + 1) / count);
+		chunk->warmup = k == 0 ? 0 : ANALYSIS_WARMUP;
+		hazardEngineInit(&chunk->engine, config);
+	}
+
+	forEachChunk(chunks, count, analyzeChunk);
+
+	for (unsigned k = 1; k < count; k++) {
+		AnalysisChunk *previous = &chunks[k - 1];
+		AnalysisChunk *chunk = &chunks[k];
+
+		if (hazardEngineEquivalent(&previous->engine, &chunk->entry)) {
+			chunk->offset = previous->offset + previous->engine.next_issue -
+							chunk->entry.next_issue;
+		} else {
+			// Continue the previous chunk's frame instead
+			chunk->engine = previous->engine;
+			chunk->engine.branches = chunk->engine.mispredictions = 0;
+			chunk->offset = previous->offset;
+			analyzeChunkRows(chunk);
+		}
+	}
+
+	forEachChunk(chunks, count, shiftChunk);
+
+	for (unsigned k = 0; k < count; k++) {
+		analysis->stalls += chunks[k].stalls;
+		for (int reason = 0; reason < NUM_HAZARDS; reason++)
+			analysis->stalls_by_reason[reason] +=
+				chunks[k].stalls_by_reason[reason];
+		analysis->branches += chunks[k].engine.branches;
+		analysis->mispredictions += chunks[k].engine.mispredictions;
+	}
+
+	// A slow instruction near the end of one chunk can finish after the
+	// whole next chunk
+	for (unsigned k = 0; k < count; k++) {
+		uint64_t finish =
+			hazardEngineTotalCycles(&chunks[k].engine) + chunks[k].offset;
+		if (finish > analysis->total_cycles)
+			analysis->total_cycles = finish;
+	}
+	analysis->valid = 1;
+	free(chunks);
+}
+
+// Single pass over the program; timings live in the program's arena so they
+// are released together with it. A static listing is read in order, so
+// conditional branches fall through and unconditional ones are taken.
+//
+// With more than one thread, long listings are split into chunks analysed in
+// parallel. Predictors that learn keep state across the whole program, so
+// they always run sequentially.
+void analyzeProgram(Analysis *analysis, Inputs *inputs,
+					const PipelineConfig *config, unsigned int threads,
+					TimelineExporter *exporter) {
+	HazardEngine engine;
+
+	analysisFree(analysis);
+	analysis->instructions_count = (uint64_t)inputs->instructions_count;
+	analysis->timings = (InstructionTiming *)arenaAlloc(
+		&inputs->arena, inputs->instructions_count * sizeof(InstructionTiming));
+
+	uint64_t chunks = analysis->instructions_count / ANALYSIS_MIN_CHUNK;
+	if (threads > chunks)
+		threads = (unsigned int)chunks;
+
+	if (threads > 1 && config->branch_policy < BRANCH_ONE_BIT &&
+		!config->out_of_order) {
+		analyzeProgramParallel(analysis, inputs, config, threads);
+
+		if (exporter != NULL)
+			for (int i = 0; i < inputs->instructions_count; i++)
+				exporterRow(exporter, (uint32_t)i, &inputs->instructions[i],
+							&analysis->timings[i]);
+		return;
+	}
+
+	hazardEngineInit(&engine, config);
+
+	for (int i = 0; i < inputs->instructions_count; i++) {
+		const Instruction *ins = &inputs->instructions[i];
+		InstructionTiming timing = hazardEngineStep(
+			&engine, ins, (uint64_t)i, !isConditionalBranch(*ins), 0);
+
+		analysis->timings[i] = timing;
+		analysisAccumulate(analysis, &timing);
+
+		if (exporter != NULL)
+			exporterRow(exporter, (uint32_t)i, ins, &timing);
+	}
+
+	analysisFinish(analysis, &engine);
+	hazardEngineFree(&engine);
+}
+
+// Adds one retired instruction's timing to the analysis and its rows
+static void analysisRecord(Analysis *analysis, const Instruction *ins,
+						   uint32_t index, const InstructionTiming *timing,
+						   TimelineExporter *exporter) {
+	if (exporter != NULL)
+		exporterRow(exporter, index, ins, timing);
+
+	if (analysis->owns_timings) {
+		analysis->timings[analysis->instructions_count] = *timing;
+		analysis->indices[analysis->instructions_count] = index;
+	}
+	analysis->instructions_count++;
+	analysisAccumulate(analysis, timing);
+}
+
+// Executes the program and analyses the retired instructions as they come
+// out, a chunk at a time. Per-instruction rows are only kept when
+// `keep_timings` is set, otherwise memory stays constant in the run length.
+// Whole basic blocks go through the block memo when it is enabled.
+void analyzeExecution(Analysis *analysis, Inputs *inputs,
+					  const PipelineConfig *config, uint64_t max_steps,
+					  int keep_timings, TimelineExporter *exporter) {
+	enum { CHUNK = 1 << 16 };
+	uint32_t *retired = malloc(CHUNK * sizeof(uint32_t));
+	uint64_t *addresses = malloc(CHUNK * sizeof(uint64_t));
+	InstructionTiming rows[BLOCK_MAX_LENGTH];
+	HazardEngine engine;
+	BlockMemo memo;
+	Machine machine;
+	Cache cache;
+	size_t count;
+
+	analysisFree(analysis);
+	analysis->executed = 1;
+	analysis->owns_timings = keep_timings;
+
+	DecodedInstruction *code = decodeProgram(inputs);
+	uint32_t program_size = (uint32_t)inputs->instructions_count;
+
+	hazardEngineInit(&engine, config);
+	blockMemoInit(&memo, inputs, config, keep_timings || exporter != NULL);
+	machineInit(&machine, inputs);
+	analysis->cached = config->cache.size != 0;
+	if (analysis->cached)
+		cacheInit(&cache, &config->cache);
+
+	while ((count = executeProgram(&machine, code, program_size, retired,
+								   addresses, CHUNK, max_steps)) > 0) {
+		if (keep_timings) {
+			uint64_t needed = analysis->instructions_count + count;
+
+			if (needed > analysis->timings_capacity) {
+				uint64_t capacity = analysis->timings_capacity * 2;
+				if (capacity < needed)
+					capacity = needed;
+
+				analysis->timings = realloc(
+					analysis->timings, capacity * sizeof(InstructionTiming));
+				analysis->indices =
+					realloc(analysis->indices, capacity * sizeof(uint32_t));
+				analysis->timings_capacity = capacity;
+			}
+		}
+
+		for (size_t i = 0; i < count;) {
+			uint32_t index = retired[i] & ~RETIRED_TAKEN;
+			const Instruction *ins = &inputs->instructions[index];
+			uint32_t length = memo.enabled ? memo.lengths[index] : 0;
+
+			// A block cut off by the end of the chunk is stepped as usual
+			if (length != 0 && i + length <= count) {
+				const BlockMemoEntry *entry = blockMemoTime(
+					&memo, &engine, inputs, &retired[i], length, rows);
+
+				if (entry != NULL && !memo.keep_rows) {
+					analysis->instructions_count += length;
+					analysis->stalls += entry->stalls;
+					for (int reason = 0; reason < NUM_HAZARDS; reason++)
+						analysis->stalls_by_reason[reason] +=
+							entry->stalls_by_reason[reason];
+				} else {
+					for (uint32_t k = 0; k < length; k++) {
+						uint32_t at = retired[i + k] & ~RETIRED_TAKEN;
+						analysisRecord(analysis, &inputs->instructions[at], at,
+									   &rows[k], exporter);
+					}
+				}
+				i += length;
+				continue;
+			}
+
+			uint32_t memory_stalls = 0;
+
+			if (analysis->cached && (isLoad(*ins) || isStore(*ins)))
+				memory_stalls =
+					cacheAccess(&cache, addresses[i], isStore(*ins));
+
+			InstructionTiming timing =
+				hazardEngineStep(&engine, ins, index,
+								 (retired[i] & RETIRED_TAKEN) != 0,
+								 memory_stalls);
+			analysisRecord(analysis, ins, index, &timing, exporter);
+			i++;
+		}
+	}
+
+	analysis->halted = machine.halted;
+	analysisFinish(analysis, &engine);
+
+	if (analysis->cached) {
+		analysis->cache_accesses = cache.accesses;
+		analysis->cache_misses = cache.misses;
+		analysis->cache_writebacks = cache.writebacks;
+		cacheFree(&cache);
+	}
+
+	machineFree(&machine);
+	blockMemoFree(&memo);
+	hazardEngineFree(&engine);
+	free(addresses);
+	free(retired);
+}
+
+// Analyses either the listing or a run of it, whichever mode is selected
+void runAnalysis(Analysis *analysis, Inputs *inputs,
+				 const PipelineConfig *config, unsigned int execute,
+				 uint64_t max_steps, unsigned int threads, int keep_timings,
+				 TimelineExporter *exporter) {
+	if (execute) {
+		analyzeExecution(analysis, inputs, config, max_steps, keep_timings,
+						 exporter);
+	} else {
+		if (config->cache.size != 0)
+			errorf("The data cache needs addresses, only -x simulates it\n");
+		analyzeProgram(analysis, inputs, config, threads, exporter);
+	}
+	analysis->multicycle = config->functional_units;
+	analysis->issue_width = config->issue_width;
+	analysis->out_of_order = config->out_of_order;
+}
+
+// }}}
+
+/*
+ *  Scheduling
+ */
+
+// {{{ Listing Writer
+
+// Writes `ins` back as assembly in the form the parser reads. Immediates and
+// branch operands are written exactly as they were given.
+void writeInstruction(OutputBuffer *out, const Instruction *ins) {
+	if (ins->type >= NUM_INSTRUCTIONS) {
+		outputString(out, "NOP");
+		return;
+	}
+
+	outputString(out, instruction_mnemonics[ins->type]);
+
+	switch (ins->format) {
+
+	case R_TYPE: {
+		const RVals *r = &ins->values.R;
+
+		if (ins->type == NOP || (ins->type == RET && r->rn == REG_LR))
+			break;
+		outputWrite(out, " ", 1);
+		if (ins->type == RET) {
+			outputString(out, registerName(r->rn));
+			break;
+		}
+		if (ins->type != CMP) {
+			outputString(out, registerName(r->rd));
+			outputString(out, ", ");
+		}
+		outputString(out, registerName(r->rn));
+		if (r->rm != REG_NONE) {
+			outputString(out, ", ");
+			outputString(out, registerName(r->rm));
+		} else if (r->shamt != NULL) {
+			outputString(out, ", #");
+			outputString(out, r->shamt);
+		}
+		break;
+	}
+
+	case I_TYPE:
+		outputWrite(out, " ", 1);
+		if (ins->type != CMPI) {
+			outputString(out, registerName(ins->values.I.rd));
+			outputString(out, ", ");
+		}
+		outputString(out, registerName(ins->values.I.rn));
+		outputString(out, ", #");
+		outputString(out, ins->values.I.imm12 ? ins->values.I.imm12 : "0");
+		break;
+
+	case D_TYPE:
+		outputWrite(out, " ", 1);
+		outputString(out, registerName(ins->values.D.rt));
+		outputString(out, ", [");
+		outputString(out, registerName(ins->values.D.rn));
+		outputString(out, ", #");
+		outputString(out, ins->values.D.addr9 ? ins->values.D.addr9 : "0");
+		outputWrite(out, "]", 1);
+		break;
+
+	case B_TYPE:
+		outputWrite(out, " ", 1);
+		if (ins->type == BR)
+			outputString(out, registerName(ins->values.B.rn));
+		else if (ins->values.B.imm26 != NULL)
+			outputString(out, ins->values.B.imm26);
+		break;
+
+	case CB_TYPE:
+		outputWrite(out, " ", 1);
+		outputString(out, registerName(ins->values.CB.rt));
+		outputString(out, ", ");
+		if (ins->values.CB.imm19 != NULL)
+			outputString(out, ins->values.CB.imm19);
+		break;
+
+	case IM_TYPE: {
+		const IMVals *im = &ins->values.IM;
+
+		outputWrite(out, " ", 1);
+		outputString(out, registerName(im->rd));
+		outputString(out, ", ");
+		if (im->imm16 != NULL) {
+			outputWrite(out, "#", 1);
+			outputString(out, im->imm16);
+		} else {
+			outputString(out, registerName(im->rn));
+		}
+		if (im->sh != NULL) {
+			outputString(out, ", LSL #");
+			outputString(out, im->sh);
+		}
+		break;
+	}
+
+	default:
+		break;
+	}
+}
+
+// Writes the program one instruction per line, each label on its own line
+// before the instruction it names
+void writeListing(const Inputs *inputs, FILE *file) {
+	const SymbolTable *symbols = &inputs->symbols;
+	uint32_t count = (uint32_t)inputs->instructions_count;
+	int32_t *first = malloc((count + 1) * sizeof(int32_t));
+	int32_t *next = malloc((symbols->capacity + 1) * sizeof(int32_t));
+	OutputBuffer out;
+
+	// Labels are chained per instruction index through the symbol slots
+	for (uint32_t i = 0; i <= count; i++)
+		first[i] = -1;
+	for (uint32_t k = 0; k < symbols->capacity; k++) {
+		const Symbol *symbol = &symbols->slots[k];
+
+		if (symbol->name != NULL && symbol->index >= 0 &&
+			(uint32_t)symbol->index <= count) {
+			next[k] = first[symbol->index];
+			first[symbol->index] = (int32_t)k;
+		}
+	}
+
+	outputInit(&out, file);
+	for (uint32_t i = 0; i <= count; i++) {
+		for (int32_t k = first[i]; k >= 0; k = next[k]) {
+			outputWrite(&out, symbols->slots[k].name,
+						symbols->slots[k].length);
+			outputString(&out, ":\n");
+		}
+		if (i < count) {
+			outputWrite(&out, "\t", 1);
+			writeInstruction(&out, &inputs->instructions[i]);
+			outputWrite(&out, "\n", 1);
+		}
+	}
+	outputFree(&out);
+
+	free(next);
+	free(first);
+}
+
+// }}}
+
+// {{{ Dependency Graph
+
+// Dependency graph of a run of instructions in compressed sparse row form:
+// the successors of node n are succ[offsets[n]] to succ[offsets[n + 1] - 1],
+// each with the cycles it has to wait after n in latency[]. Edges always
+// point forward. The graph is built in two passes over the instructions,
+// one counting each node's edges and one filling them in, so it never holds
+// more than the CSR arrays (five bytes an edge).
+typedef struct {
+	uint32_t nodes, edges;
+	uint32_t *offsets;
+	uint32_t *succ;
+	uint8_t *latency;
+	uint32_t *fill;
+	size_t node_capacity, edge_capacity;
+} DependencyGraph;
+
+// Last store and loads since then of one 8-byte word of memory
+typedef struct {
+	uint64_t word;
+	int32_t store;
+	int32_t loads;
+} MemoryDependency;
+
+// Lists of the readers of each register (and loads of memory) since its
+// last write, shared by both passes, plus the word table of a trace with
+// addresses
+typedef struct {
+	uint32_t *reader_node;
+	int32_t *reader_next;
+	size_t capacity;
+	MemoryDependency *words;
+	uint64_t words_mask;
+	uint64_t words_used;
+} DependencyScratch;
+
+static inline void graphAddEdge(DependencyGraph *graph, uint32_t from,
+								uint32_t to, uint8_t latency) {
+	if (graph->fill == NULL) {
+		graph->offsets[from + 1]++;
+		return;
+	}
+	uint32_t slot = graph->fill[from]++;
+	graph->succ[slot] = to;
+	graph->latency[slot] = latency;
+}
+
+void graphFree(DependencyGraph *graph) {
+	free(graph->offsets);
+	free(graph->succ);
+	free(graph->latency);
+	free(graph->fill);
+	memset(graph, 0, sizeof *graph);
+}
+
+void dependencyScratchFree(DependencyScratch *scratch) {
+	free(scratch->reader_node);
+	free(scratch->reader_next);
+	free(scratch->words);
+	memset(scratch, 0, sizeof *scratch);
+}
+
+// Cycles between the EX stages of `ins` and an instruction that reads its
+// result, under the forwarding paths of the in-order pipeline
+static uint8_t resultLatency(const PipelineConfig *config,
+							 const Instruction *ins) {
+	uint32_t extra = opcodeLatency(config, ins->type) - 1;
+	uint32_t latency;
+
+	if (isLoad(*ins) && config->forward_mem_wb)
+		latency = 2;
+	else if (config->forward_ex_mem)
+		latency = 1;
+	else if (config->forward_mem_wb)
+		latency = 2;
+	else
+		latency = config->split_register_file ? 3 : 4;
+	return (uint8_t)(latency + extra);
+}
+
+// Entry of `word` in the word table, which is kept at most half full
+static MemoryDependency *memoryDependency(DependencyScratch *scratch,
+										  uint64_t word) {
+	if (2 * (scratch->words_used + 1) > scratch->words_mask + 1) {
+		uint64_t size = (scratch->words_mask + 1) * 2;
+		MemoryDependency *old = scratch->words;
+		MemoryDependency *words = malloc(size * sizeof(MemoryDependency));
+
+		memset(words, 0xFF, size * sizeof(MemoryDependency));
+		for (uint64_t k = 0; old != NULL && k <= scratch->words_mask; k++) {
+			if (old[k].word == UINT64_MAX)
+				continue;
+			uint64_t slot = (old[k].word * 0x9E3779B97F4A7C15ull) >> 20;
+			while (words[slot & (size - 1)].word != UINT64_MAX)
+				slot++;
+			words[slot & (size - 1)] = old[k];
+		}
+		free(old);
+		scratch->words = words;
+		scratch->words_mask = size - 1;
+	}
+
+	uint64_t slot = (word * 0x9E3779B97F4A7C15ull) >> 20;
+	for (;; slot++) {
+		MemoryDependency *entry = &scratch->words[slot & scratch->words_mask];
+
+		if (entry->word == word)
+			return entry;
+		if (entry->word == UINT64_MAX) {
+			*entry = (MemoryDependency){word, -1, -1};
+			scratch->words_used++;
+			return entry;
+		}
+	}
+}
+
+// One pass over the nodes, adding every edge. Node n is
+// instructions[trace[n]], or instructions[n] without a trace.
+//
+// A register keeps its last writer and the readers since then, so every
+// instruction only links to what it really conflicts with: RAW edges wait
+// for the producer's result, WAR edges allow the same cycle and WAW edges
+// keep writes in order. Memory works the same way on the last store and
+// the loads since it, per 8-byte word when the trace has addresses and
+// for all of memory at once otherwise.
+static void scanDependencies(DependencyGraph *graph,
+							 const Instruction *instructions,
+							 const uint32_t *trace, const uint64_t *addresses,
+							 const PipelineConfig *config,
+							 DependencyScratch *scratch) {
+	int32_t writer[NUM_REGISTERS], readers[NUM_REGISTERS];
+	MemoryDependency memory = {0, -1, -1};
+	uint32_t *reader_node = scratch->reader_node;
+	int32_t *reader_next = scratch->reader_next;
+	uint32_t readings = 0;
+
+	for (int r = 0; r < NUM_REGISTERS; r++)
+		writer[r] = readers[r] = -1;
+	if (scratch->words != NULL) {
+		memset(scratch->words, 0xFF,
+			   (scratch->words_mask + 1) * sizeof(MemoryDependency));
+		scratch->words_used = 0;
+	}
+
+	for (uint32_t n = 0; n < graph->nodes; n++) {
+		const Instruction *ins = &instructions[trace ? trace[n] : n];
+
+		for (uint32_t reads = ins->read_mask; reads != 0;
+			 reads &= reads - 1) {
+			int r = __builtin_ctz(reads);
+
+			if (writer[r] >= 0) {
+				const Instruction *producer =
+					&instructions[trace ? trace[writer[r]]
+										: (uint32_t)writer[r]];
+				graphAddEdge(graph, (uint32_t)writer[r], n,
+							 resultLatency(config, producer));
+			}
+			reader_node[readings] = n;
+			reader_next[readings] = readers[r];
+			readers[r] = (int32_t)readings++;
+		}
+
+		for (uint32_t writes = ins->write_mask; writes != 0;
+			 writes &= writes - 1) {
+			int r = __builtin_ctz(writes);
+
+			if (writer[r] >= 0)
+				graphAddEdge(graph, (uint32_t)writer[r], n, 1);
+			for (int32_t k = readers[r]; k >= 0; k = reader_next[k])
+				if (reader_node[k] != n)
+					graphAddEdge(graph, reader_node[k], n, 0);
+			writer[r] = (int32_t)n;
+			readers[r] = -1;
+		}
+
+		if (!isLoad(*ins) && !isStore(*ins))
+			continue;
+
+		MemoryDependency *word =
+			addresses != NULL ? memoryDependency(scratch, addresses[n] >> 3)
+							  : &memory;
+		if (isLoad(*ins)) {
+			if (word->store >= 0)
+				graphAddEdge(graph, (uint32_t)word->store, n, 1);
+			reader_node[readings] = n;
+			reader_next[readings] = word->loads;
+			word->loads = (int32_t)readings++;
+		} else {
+			if (word->store >= 0)
+				graphAddEdge(graph, (uint32_t)word->store, n, 1);
+			for (int32_t k = word->loads; k >= 0; k = reader_next[k])
+				graphAddEdge(graph, reader_node[k], n, 0);
+			word->store = (int32_t)n;
+			word->loads = -1;
+		}
+	}
+}
+
+// Builds the graph of `nodes` instructions (see scanDependencies). Arrays
+// are reused from one call to the next and only grow.
+void buildDependencyGraph(DependencyGraph *graph,
+						  const Instruction *instructions,
+						  const uint32_t *trace, const uint64_t *addresses,
+						  uint32_t nodes, const PipelineConfig *config,
+						  DependencyScratch *scratch) {
+	// At most three register reads and one load per instruction
+	if ((size_t)nodes * 4 > scratch->capacity) {
+		scratch->capacity = (size_t)nodes * 4;
+		scratch->reader_node = realloc(scratch->reader_node,
+									   scratch->capacity * sizeof(uint32_t));
+		scratch->reader_next = realloc(scratch->reader_next,
+									   scratch->capacity * sizeof(int32_t));
+	}
+	if (nodes + 1 > graph->node_capacity) {
+		graph->node_capacity = (size_t)nodes + 1;
+		graph->offsets =
+			realloc(graph->offsets, graph->node_capacity * sizeof(uint32_t));
+		graph->fill =
+			realloc(graph->fill, graph->node_capacity * sizeof(uint32_t));
+	}
+
+	uint32_t *fill = graph->fill;
+	graph->nodes = nodes;
+	graph->fill = NULL;
+	memset(graph->offsets, 0, ((size_t)nodes + 1) * sizeof(uint32_t));
+	scanDependencies(graph, instructions, trace, addresses, config, scratch);
+
+	for (uint32_t n = 0; n < nodes; n++)
+		graph->offsets[n + 1] += graph->offsets[n];
+	graph->edges = graph->offsets[nodes];
+	if (graph->edges > graph->edge_capacity) {
+		graph->edge_capacity = graph->edges;
+		graph->succ =
+			realloc(graph->succ, graph->edge_capacity * sizeof(uint32_t));
+		graph->latency = realloc(graph->latency, graph->edge_capacity);
+	}
+
+	memcpy(fill, graph->offsets, (size_t)nodes * sizeof(uint32_t));
+	graph->fill = fill;
+	scanDependencies(graph, instructions, trace, addresses, config, scratch);
+}
+
+// }}}
+
+// {{{ List Scheduler
+
+// Binary min-heap of (key, node) pairs, ties going to the lower node
+typedef struct {
+	uint64_t key;
+	uint32_t node;
+} HeapEntry;
+
+typedef struct {
+	HeapEntry *entries;
+	uint32_t count;
+} Heap;
+
+static inline int heapBefore(HeapEntry a, HeapEntry b) {
+	return a.key < b.key || (a.key == b.key && a.node < b.node);
+}
+
+static void heapPush(Heap *heap, uint64_t key, uint32_t node) {
+	HeapEntry entry = {key, node};
+	uint32_t i = heap->count++;
+
+	while (i > 0 && heapBefore(entry, heap->entries[(i - 1) / 2])) {
+		heap->entries[i] = heap->entries[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	heap->entries[i] = entry;
+}
+
+static HeapEntry heapPop(Heap *heap) {
+	HeapEntry top = heap->entries[0];
+	HeapEntry last = heap->entries[--heap->count];
+	uint32_t i = 0;
+
+	for (;;) {
+		uint32_t child = 2 * i + 1;
+
+		if (child >= heap->count)
+			break;
+		if (child + 1 < heap->count &&
+			heapBefore(heap->entries[child + 1], heap->entries[child]))
+			child++;
+		if (!heapBefore(heap->entries[child], last))
+			break;
+		heap->entries[i] = heap->entries[child];
+		i = child;
+	}
+	heap->entries[i] = last;
+	return top;
+}
+
+// List-schedules block [start, stop) into order[]. Each step issues, among
+// the instructions whose inputs are ready, the one with the longest chain of
+// latencies after it; only when none is ready does it fall back to the one
+// that becomes ready first, which is where the pipeline stalls.
+static void scheduleBlock(const DependencyGraph *graph, uint32_t start,
+						  uint32_t *order, uint32_t *height,
+						  uint32_t *predecessors, uint64_t *earliest,
+						  Heap *ready, Heap *waiting) {
+	uint32_t nodes = graph->nodes;
+
+	// Edges only go forward, so reverse order is a topological order
+	for (uint32_t n = nodes; n-- > 0;) {
+		height[n] = 0;
+		for (uint32_t e = graph->offsets[n]; e < graph->offsets[n + 1]; e++) {
+			uint32_t h = graph->latency[e] + height[graph->succ[e]];
+			if (h > height[n])
+				height[n] = h;
+		}
+	}
+
+	memset(predecessors, 0, nodes * sizeof(uint32_t));
+	for (uint32_t e = 0; e < graph->edges; e++)
+		predecessors[graph->succ[e]]++;
+
+	ready->count = waiting->count = 0;
+	for (uint32_t n = 0; n < nodes; n++) {
+		earliest[n] = 0;
+		if (predecessors[n] == 0)
+			heapPush(waiting, 0, n);
+	}
+
+	uint64_t cycle = 0;
+	for (uint32_t issued = 0; issued < nodes;) {
+		while (waiting->count > 0 && waiting->entries[0].key <= cycle) {
+			uint32_t n = heapPop(waiting).node;
+			heapPush(ready, UINT32_MAX - height[n], n);
+		}
+		if (ready->count == 0) {
+			cycle = waiting->entries[0].key;
+			continue;
+		}
+
+		uint32_t n = heapPop(ready).node;
+		order[issued++] = start + n;
+
+		for (uint32_t e = graph->offsets[n]; e < graph->offsets[n + 1]; e++) {
+			uint32_t s = graph->succ[e];
+
+			if (cycle + graph->latency[e] > earliest[s])
+				earliest[s] = cycle + graph->latency[e];
+			if (--predecessors[s] == 0)
+				heapPush(waiting, earliest[s], s);
+		}
+		cycle++;
+	}
+}
+
+// Reorders the instructions of every basic block to hide load-use and other
+// RAW latencies. Blocks start at labels, branch targets and after branches,
+// and a branch stays last in its block, so every label and branch offset
+// still points where it did. Returns the number of instructions moved.
+uint32_t scheduleProgram(Inputs *inputs, const PipelineConfig *config) {
+	uint32_t count = (uint32_t)inputs->instructions_count;
+	Instruction *instructions = inputs->instructions;
+	uint8_t *leader = calloc(count + 1, 1);
+	uint32_t moved = 0;
+
+	if (count == 0) {
+		free(leader);
+		return 0;
+	}
+
+	leader[0] = 1;
+	for (uint32_t k = 0; k < inputs->symbols.capacity; k++) {
+		const Symbol *symbol = &inputs->symbols.slots[k];
+		if (symbol->name != NULL && symbol->index >= 0 &&
+			(uint32_t)symbol->index <= count)
+			leader[symbol->index] = 1;
+	}
+	for (uint32_t i = 0; i < count; i++) {
+		if (isBranch(instructions[i]) ||
+			instructions[i].type >= NUM_INSTRUCTIONS)
+			leader[i + 1] = 1;
+		if (instructions[i].target >= 0 &&
+			(uint32_t)instructions[i].target <= count)
+			leader[instructions[i].target] = 1;
+	}
+
+	DependencyGraph graph = {0};
+	DependencyScratch scratch = {0};
+	uint32_t *order = malloc(count * sizeof(uint32_t));
+	uint32_t *height = malloc(count * sizeof(uint32_t));
+	uint32_t *predecessors = malloc(count * sizeof(uint32_t));
+	uint64_t *earliest = malloc(count * sizeof(uint64_t));
+	Heap ready = {malloc(count * sizeof(HeapEntry)), 0};
+	Heap waiting = {malloc(count * sizeof(HeapEntry)), 0};
+	Instruction *scheduled = arenaAlloc(&inputs->arena,
+										count * sizeof(Instruction));
+
+	for (uint32_t start = 0; start < count;) {
+		uint32_t end = start + 1;
+		while (end < count && !leader[end])
+			end++;
+
+		// The instruction that ends a block keeps its place
+		uint32_t stop = end;
+		if (isBranch(instructions[end - 1]) ||
+			instructions[end - 1].type >= NUM_INSTRUCTIONS)
+			stop--;
+
+		if (stop > start) {
+			buildDependencyGraph(&graph, instructions + start, NULL, NULL,
+								 stop - start, config, &scratch);
+			scheduleBlock(&graph, start, order + start, height, predecessors,
+						  earliest, &ready, &waiting);
+		}
+		for (uint32_t i = stop; i < end; i++)
+			order[i] = i;
+		start = end;
+	}
+
+	for (uint32_t i = 0; i < count; i++) {
+		scheduled[i] = instructions[order[i]];
+		moved += order[i] != i;
+	}
+	inputs->instructions = scheduled;
+
+	graphFree(&graph);
+	dependencyScratchFree(&scratch);
+	free(waiting.entries);
+	free(ready.entries);
+	free(earliest);
+	free(predecessors);
+	free(height);
+	free(order);
+	free(leader);
+	return moved;
+}
+
+// Schedules the program, writes the new listing to `path` (- for stdout)
+// and reports the cycle counts of both versions. The scheduled program
+// replaces the original in `inputs`.
+int runSchedule(Inputs *inputs, const PipelineConfig *config,
+				unsigned int execute, uint64_t max_steps, unsigned int threads,
+				const char *path) {
+	Analysis before = {0}, after = {0};
+	FILE *file = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+
+	if (file == NULL) {
+		errorf("Could not open %s\n", path);
+		return -1;
+	}
+
+	runAnalysis(&before, inputs, config, execute, max_steps, threads, 0, NULL);
+	uint32_t moved = scheduleProgram(inputs, config);
+	runAnalysis(&after, inputs, config, execute, max_steps, threads, 0, NULL);
+
+	writeListing(inputs, file);
+	if (file != stdout)
+		fclose(file);
+
+	printf("\n\033[1m\033[32mScheduled %u of %d instructions\033[0m\n",
+		   moved, inputs->instructions_count);
+	printf("\033[32mTotal Cycle Count: %llu -> %llu\033[0m\n",
+		   (unsigned long long)before.total_cycles,
+		   (unsigned long long)after.total_cycles);
+	printf("\033[32mLoad-Use Stalls: %llu -> %llu\033[0m\n",
+		   (unsigned long long)before.stalls_by_reason[HAZARD_LOAD_USE],
+		   (unsigned long long)after.stalls_by_reason[HAZARD_LOAD_USE]);
+	printf("\033[32mData Stalls: %llu -> %llu\033[0m\n",
+		   (unsigned long long)before.stalls_by_reason[HAZARD_DATA],
+		   (unsigned long long)after.stalls_by_reason[HAZARD_DATA]);
+
+	analysisFree(&before);
+	analysisFree(&after);
+	return 0;
+}
+
+// }}}
+
+// {{{ Critical Path
+
+// Longest chain of dependencies through a listing or an executed trace.
+// Every instruction waits only for the results it really needs, so the
+// chain's length in cycles is the best any pipeline with these latencies
+// could do, and instructions / length bounds the IPC it could reach.
+typedef struct {
+	uint64_t instructions;
+	uint64_t edges;
+	uint64_t length;
+	uint32_t *path;
+	uint32_t path_count;
+	int executed;
+} CriticalPath;
+
+void criticalPathFree(CriticalPath *result) {
+	free(result->path);
+	memset(result, 0, sizeof *result);
+}
+
+// Longest path through `graph`, where a node takes its result latency.
+// Edges point forward, so one pass in node order relaxes each edge once.
+// path[] gets the static index of every instruction on the path, in order.
+static void longestPath(CriticalPath *result, const DependencyGraph *graph,
+						const Instruction *instructions,
+						const uint32_t *trace, const PipelineConfig *config) {
+	uint32_t nodes = graph->nodes;
+	uint64_t *start = calloc(nodes, sizeof(uint64_t));
+	uint32_t *via = malloc(nodes * sizeof(uint32_t));
+	uint32_t last = 0;
+
+	// via[] is the predecessor that sets each node's start, if any
+	memset(via, 0xFF, nodes * sizeof(uint32_t));
+	result->length = 0;
+	for (uint32_t n = 0; n < nodes; n++) {
+		uint32_t index = trace ? trace[n] : n;
+		uint64_t finish =
+			start[n] + resultLatency(config, &instructions[index]);
+
+		if (finish > result->length) {
+			result->length = finish;
+			last = n;
+		}
+		for (uint32_t e = graph->offsets[n]; e < graph->offsets[n + 1]; e++) {
+			uint32_t s = graph->succ[e];
+
+			if (start[n] + graph->latency[e] > start[s]) {
+				start[s] = start[n] + graph->latency[e];
+				via[s] = n;
+			}
+		}
+	}
+
+	result->path_count = 0;
+	if (nodes > 0) {
+		for (uint32_t n = last; n != UINT32_MAX; n = via[n])
+			result->path_count++;
+		result->path = malloc(result->path_count * sizeof(uint32_t));
+		uint32_t k = result->path_count;
+		for (uint32_t n = last; n != UINT32_MAX; n = via[n])
+			result->path[--k] = trace ? trace[n] : n;
+	}
+
+	free(via);
+	free(start);
+}
+
+// Builds the dependency graph of the listing, or of the executed trace with
+// its real memory addresses, and finds its critical path
+void analyzeCriticalPath(CriticalPath *result, Inputs *inputs,
+						 const PipelineConfig *config, unsigned int execute,
+						 uint64_t max_steps) {
+	DependencyGraph graph = {0};
+	DependencyScratch scratch = {0};
+	uint32_t *trace = NULL;
+	uint64_t *addresses = NULL;
+	uint64_t nodes = (uint64_t)inputs->instructions_count;
+
+	memset(result, 0, sizeof *result);
+
+	if (execute) {
+		enum { CHUNK = 1 << 16 };
+		uint64_t capacity = CHUNK;
+		Machine machine;
+		size_t count;
+
+		trace = malloc(capacity * sizeof(uint32_t));
+		addresses = malloc(capacity * sizeof(uint64_t));
+		machineInit(&machine, inputs);
+		DecodedInstruction *code = decodeProgram(inputs);
+
+		nodes = 0;
+		while (nodes + CHUNK <= UINT32_MAX &&
+			   (count = executeProgram(
+					&machine, code, (uint32_t)inputs->instructions_count,
+					trace + nodes, addresses + nodes, CHUNK, max_steps)) > 0) {
+			for (size_t i = 0; i < count; i++)
+				trace[nodes + i] &= ~RETIRED_TAKEN;
+			nodes += count;
+			if (nodes + CHUNK > capacity) {
+				capacity *= 2;
+				trace = realloc(trace, capacity * sizeof(uint32_t));
+				addresses = realloc(addresses, capacity * sizeof(uint64_t));
+			}
+		}
+		machineFree(&machine);
+		result->executed = 1;
+	}
+
+	buildDependencyGraph(&graph, inputs->instructions, trace, addresses,
+						 (uint32_t)nodes, config, &scratch);
+	dependencyScratchFree(&scratch);
+	free(addresses);
+
+	result->instructions = nodes;
+	result->edges = graph.edges;
+	longestPath(result, &graph, inputs->instructions, trace, config);
+
+	graphFree(&graph);
+	free(trace);
+}
+
+void printCriticalPath(const CriticalPath *result, const Inputs *inputs,
+					   const Analysis *analysis) {
+	enum { SHOWN = 32 };
+	OutputBuffer out;
+
+	printf("\n\033[1m\033[32mCritical Path: %llu cycles through %u of "
+		   "%llu instructions (%llu dependencies)\033[0m\n",
+		   (unsigned long long)result->length, result->path_count,
+		   (unsigned long long)result->instructions,
+		   (unsigned long long)result->edges);
+	printf("\033[32mILP Upper Bound: %.3f instructions per cycle\033[0m\n",
+		   result->length != 0
+			   ? (double)result->instructions / (double)result->length
+			   : 0.0);
+	if (analysis->valid && analysis->total_cycles != 0)
+		printf("\033[32mAchieved IPC: %.3f (%.1f%% of the bound)\033[0m\n",
+			   (double)analysis->instructions_count /
+				   (double)analysis->total_cycles,
+			   result->length != 0 && result->instructions != 0
+				   ? 100.0 * (double)result->length /
+						 (double)analysis->total_cycles
+				   : 0.0);
+
+	fflush(stdout);
+	outputInit(&out, stdout);
+	outputString(&out, "\n\033[1mInstructions on the critical path:\033[0m\n");
+	for (uint32_t k = 0; k < result->path_count && k < SHOWN; k++) {
+		outputUnsigned(&out, result->path[k], 10);
+		outputString(&out, "  ");
+		writeInstruction(&out, &inputs->instructions[result->path[k]]);
+		outputWrite(&out, "\n", 1);
+	}
+	if (result->path_count > SHOWN) {
+		outputString(&out, "       ... ");
+		outputUnsigned(&out, result->path_count - SHOWN, 0);
+		outputString(&out, " more\n");
+	}
+	outputWrite(&out, "\n", 1);
+	outputFree(&out);
+}
+
+// }}}
+
+/*
+ *  Machine Code
+ */
+
+// {{{ Encodings
+
+// How the operands of an encoding are laid out in the 32-bit word. LEGv8
+// instructions use the field layout of their format; the rest use the
+// ARMv8 word they stand for.
+typedef enum {
+	LAYOUT_R,		// rd, rn, rm and shamt
+	LAYOUT_RM,		// rd, rn, rm (shamt field fixed)
+	LAYOUT_SHIFT,	// rd, rn, shamt (LEGv8 LSL/LSR)
+	LAYOUT_IMMR,	// rd, rn, shift in immr (ARMv8 ASR is SBFM)
+	LAYOUT_EXTEND,	// rd, rn
+	LAYOUT_COMPARE, // rn, rm and shamt, rd is XZR
+	LAYOUT_MOVE,	// rd and the source in rm, rn is XZR
+	LAYOUT_JUMP,	// rn (BR, RET)
+	LAYOUT_I,		// rd, rn, imm12
+	LAYOUT_COMPARE_I,
+	LAYOUT_D,		// rt, rn, addr9
+	LAYOUT_B,		// imm26
+	LAYOUT_CB,		// rt, imm19
+	LAYOUT_COND,	// imm19, condition fixed
+	LAYOUT_IM,		// rd, imm16, hw
+	LAYOUT_NONE,
+} EncodingLayout;
+
+typedef struct {
+	Opcode op;
+	EncodingLayout layout;
+	uint32_t match, mask;
+} Encoding;
+
+// Aliases come before the instruction they alias so the decoder prefers them.
+// The opcode fields are the LEGv8 ones; B.cond keeps its condition in Rt.
+static const Encoding encodings[] = {
+	{CMP, LAYOUT_COMPARE, 0xEB00001F, 0xFFE0001F},
+	{MOV, LAYOUT_MOVE, 0xAA0003E0, 0xFFE003E0},
+	{ADD, LAYOUT_R, 0x8B000000, 0xFFE00000},
+	{ADDS, LAYOUT_R, 0xAB000000, 0xFFE00000},
+	{SUB, LAYOUT_R, 0xCB000000, 0xFFE00000},
+	{SUBS, LAYOUT_R, 0xEB000000, 0xFFE00000},
+	{AND, LAYOUT_R, 0x8A000000, 0xFFE00000},
+	{ANDS, LAYOUT_R, 0xEA000000, 0xFFE00000},
+	{ORR, LAYOUT_R, 0xAA000000, 0xFFE00000},
+	{EOR, LAYOUT_R, 0xCA000000, 0xFFE00000},
+	{LSL, LAYOUT_SHIFT, 0xD3600000, 0xFFE00000},
+	{LSR, LAYOUT_SHIFT, 0xD3400000, 0xFFE00000},
+	{ASR, LAYOUT_IMMR, 0x9340FC00, 0xFFC0FC00},
+	{LSL, LAYOUT_RM, 0x9AC02000, 0xFFE0FC00},
+	{LSR, LAYOUT_RM, 0x9AC02400, 0xFFE0FC00},
+	{ASR, LAYOUT_RM, 0x9AC02800, 0xFFE0FC00},
+	{MUL, LAYOUT_RM, 0x9B007C00, 0xFFE0FC00},
+	{SMULH, LAYOUT_RM, 0x9B407C00, 0xFFE0FC00},
+	{UMULH, LAYOUT_RM, 0x9BC07C00, 0xFFE0FC00},
+	{UDIV, LAYOUT_RM, 0x9AC00800, 0xFFE0FC00},
+	{SDIV, LAYOUT_RM, 0x9AC00C00, 0xFFE0FC00},
+	{SXTB, LAYOUT_EXTEND, 0x93401C00, 0xFFFFFC00},
+	{SXTH, LAYOUT_EXTEND, 0x93403C00, 0xFFFFFC00},
+	{SXTW, LAYOUT_EXTEND, 0x93407C00, 0xFFFFFC00},
+	{UXTB, LAYOUT_EXTEND, 0x53001C00, 0xFFFFFC00},
+	{UXTH, LAYOUT_EXTEND, 0x53003C00, 0xFFFFFC00},
+	{UXTW, LAYOUT_EXTEND, 0x53007C00, 0xFFFFFC00},
+	{NOP, LAYOUT_NONE, 0xD503201F, 0xFFFFFFFF},
+	{RET, LAYOUT_JUMP, 0xD65F0000, 0xFFFFFC1F},
+	{BR, LAYOUT_JUMP, 0xD61F0000, 0xFFFFFC1F},
+	{CMPI, LAYOUT_COMPARE_I, 0xF100001F, 0xFFC0001F},
+	{ADDI, LAYOUT_I, 0x91000000, 0xFFC00000},
+	{ADDIS, LAYOUT_I, 0xB1000000, 0xFFC00000},
+	{SUBI, LAYOUT_I, 0xD1000000, 0xFFC00000},
+	{SUBIS, LAYOUT_I, 0xF1000000, 0xFFC00000},
+	{ANDI, LAYOUT_I, 0x92000000, 0xFFC00000},
+	{ORRI, LAYOUT_I, 0xB2000000, 0xFFC00000},
+	{EORI, LAYOUT_I, 0xD2000000, 0xFFC00000},
+	{LDUR, LAYOUT_D, 0xF8400000, 0xFFE00C00},
+	{STUR, LAYOUT_D, 0xF8000000, 0xFFE00C00},
+	{LDURB, LAYOUT_D, 0x38400000, 0xFFE00C00},
+	{STURB, LAYOUT_D, 0x38000000, 0xFFE00C00},
+	{LDURH, LAYOUT_D, 0x78400000, 0xFFE00C00},
+	{STURH, LAYOUT_D, 0x78000000, 0xFFE00C00},
+	{LDURSW, LAYOUT_D, 0xB8800000, 0xFFE00C00},
+	{MOVZ, LAYOUT_IM, 0xD2800000, 0xFF800000},
+	{MOVK, LAYOUT_IM, 0xF2800000, 0xFF800000},
+	{MOVN, LAYOUT_IM, 0x92800000, 0xFF800000},
+	{B, LAYOUT_B, 0x14000000, 0xFC000000},
+	{BL, LAYOUT_B, 0x94000000, 0xFC000000},
+	{CBZ, LAYOUT_CB, 0xB4000000, 0xFF000000},
+	{CBNZ, LAYOUT_CB, 0xB5000000, 0xFF000000},
+	{B_EQ, LAYOUT_COND, 0x54000000, 0xFF00001F},
+	{B_NE, LAYOUT_COND, 0x54000001, 0xFF00001F},
+	{B_GE, LAYOUT_COND, 0x5400000A, 0xFF00001F},
+	{B_LT, LAYOUT_COND, 0x5400000B, 0xFF00001F},
+	{B_GT, LAYOUT_COND, 0x5400000C, 0xFF00001F},
+	{B_LE, LAYOUT_COND, 0x5400000D, 0xFF00001F},
+};
+
+#define NUM_ENCODINGS (sizeof encodings / sizeof encodings[0])
+
+// The decoder indexes the top 11 bits (the widest LEGv8 opcode field) and
+// checks the few encodings that share that prefix in table order
+#define DECODE_PRIMARY_BITS 11
+#define DECODE_PRIMARY_SIZE (1 << DECODE_PRIMARY_BITS)
+
+static uint16_t decode_first[DECODE_PRIMARY_SIZE + 1];
+static uint8_t decode_candidates[DECODE_PRIMARY_SIZE * 2];
+
+void initDecoder(void) {
+	uint32_t used = 0;
+
+	for (uint32_t prefix = 0; prefix < DECODE_PRIMARY_SIZE; prefix++) {
+		uint32_t high = prefix << (32 - DECODE_PRIMARY_BITS);
+
+		decode_first[prefix] = (uint16_t)used;
+		for (uint32_t e = 0; e < NUM_ENCODINGS; e++) {
+			uint32_t mask = encodings[e].mask & 0xFFE00000;
+			if ((high & mask) == (encodings[e].match & mask) &&
+				used < sizeof decode_candidates)
+				decode_candidates[used++] = (uint8_t)e;
+		}
+	}
+	decode_first[DECODE_PRIMARY_SIZE] = (uint16_t)used;
+}
+
+// }}}
+
+// {{{ Encoder
+
+static inline uint32_t registerField(Register r) {
+	return r < NUM_REGISTERS ? r : REG_XZR;
+}
+
+// Checks that value fits a field of `bits` bits, signed or not
+static int fitsField(int64_t value, int bits, int is_signed) {
+	if (is_signed)
+		return value >= -(1ll << (bits - 1)) && value < (1ll << (bits - 1));
+	return value >= 0 && value < (1ll << bits);
+}
+
+static const Encoding *findEncoding(Opcode op, int register_form) {
+	for (uint32_t e = 0; e < NUM_ENCODINGS; e++) {
+		if (encodings[e].op != op)
+			continue;
+		if (register_form == (encodings[e].layout == LAYOUT_RM) ||
+			(op != LSL && op != LSR && op != ASR))
+			return &encodings[e];
+	}
+	return NULL;
+}
+
+// Assembles the instruction at index `pc` into one 32-bit word. Returns 0, or
+// -1 when an operand does not fit its field.
+int encodeInstruction(const Instruction *ins, int32_t pc, uint32_t *word) {
+	Instruction alias = *ins;
+	const Encoding *encoding;
+	int64_t imm = 0;
+
+	if (ins->type >= NUM_INSTRUCTIONS)
+		return -1;
+
+	// A negative add immediate is a subtract and vice versa; a MOV of an
+	// immediate is MOVZ or MOVN
+	if (ins->format == I_TYPE) {
+		static const Opcode negated[NUM_INSTRUCTIONS] = {
+			[ADDI] = SUBI, [SUBI] = ADDI, [ADDIS] = SUBIS, [SUBIS] = ADDIS,
+		};
+		imm = immediateValue(ins->values.I.imm12);
+		if (imm < 0 && negated[ins->type] != 0) {
+			alias.type = negated[ins->type];
+			imm = -imm;
+		}
+	} else if (ins->type == MOV && ins->values.IM.rn == REG_NONE) {
+		imm = immediateValue(ins->values.IM.imm16);
+		alias.type = imm < 0 ? MOVN : MOVZ;
+		if (imm < 0)
+			imm = ~imm;
+	} else if (ins->format == IM_TYPE) {
+		imm = immediateValue(ins->values.IM.imm16);
+	}
+
+	encoding = findEncoding(alias.type, ins->format == R_TYPE &&
+											ins->values.R.shamt == NULL);
+	if (encoding == NULL)
+		return -1;
+
+	uint32_t w = encoding->match;
+	const RVals *r = &ins->values.R;
+
+	switch (encoding->layout) {
+
+	case LAYOUT_R:
+	case LAYOUT_SHIFT:
+	case LAYOUT_COMPARE: {
+		int64_t shamt = immediateValue(r->shamt);
+		if (!fitsField(shamt, 6, 0))
+			return -1;
+		w |= (uint32_t)shamt << 10 | registerField(r->rn) << 5;
+		if (encoding->layout != LAYOUT_SHIFT)
+			w |= registerField(r->rm) << 16;
+		if (encoding->layout != LAYOUT_COMPARE)
+			w |= registerField(r->rd);
+		break;
+	}
+
+	case LAYOUT_RM:
+		w |= registerField(r->rm) << 16 | registerField(r->rn) << 5 |
+			 registerField(r->rd);
+		break;
+
+	case LAYOUT_IMMR: {
+		int64_t shamt = immediateValue(r->shamt);
+		if (!fitsField(shamt, 6, 0))
+			return -1;
+		w |= (uint32_t)shamt << 16 | registerField(r->rn) << 5 |
+			 registerField(r->rd);
+		break;
+	}
+
+	case LAYOUT_EXTEND:
+		w |= registerField(r->rn) << 5 | registerField(r->rd);
+		break;
+
+	case LAYOUT_MOVE:
+		w |= registerField(ins->values.IM.rn) << 16 |
+			 registerField(ins->values.IM.rd);
+		break;
+
+	case LAYOUT_JUMP:
+		w |= registerField(ins->format == B_TYPE ? ins->values.B.rn : r->rn)
+			 << 5;
+		break;
+
+	case LAYOUT_I:
+	case LAYOUT_COMPARE_I:
+		if (!fitsField(imm, 12, 0))
+			return -1;
+		w |= (uint32_t)imm << 10 | registerField(ins->values.I.rn) << 5;
+		if (encoding->layout == LAYOUT_I)
+			w |= registerField(ins->values.I.rd);
+		break;
+
+	case LAYOUT_D: {
+		int64_t addr = immediateValue(ins->values.D.addr9);
+		if (!fitsField(addr, 9, 1))
+			return -1;
+		w |= ((uint32_t)addr & 0x1FF) << 12 |
+			 registerField(ins->values.D.rn) << 5 |
+			 registerField(ins->values.D.rt);
+		break;
+	}
+
+	case LAYOUT_B:
+	case LAYOUT_CB:
+	case LAYOUT_COND: {
+		int64_t offset = (int64_t)ins->target - pc;
+		int bits = encoding->layout == LAYOUT_B ? 26 : 19;
+		if (ins->target < 0 || !fitsField(offset, bits, 1))
+			return -1;
+		if (encoding->layout == LAYOUT_B)
+			w |= (uint32_t)offset & 0x3FFFFFF;
+		else
+			w |= ((uint32_t)offset & 0x7FFFF) << 5;
+		if (encoding->layout == LAYOUT_CB)
+			w |= registerField(ins->values.CB.rt);
+		break;
+	}
+
+	case LAYOUT_IM: {
+		int64_t shift = immediateValue(ins->values.IM.sh);
+		if (!fitsField(imm, 16, 0) || shift < 0 || shift > 48 || shift % 16)
+			return -1;
+		w |= (uint32_t)(shift / 16) << 21 | (uint32_t)imm << 5 |
+			 registerField(ins->values.IM.rd);
+		break;
+	}
+
+	case LAYOUT_NONE:
+		break;
+	}
+
+	*word = w;
+	return 0;
+}
+
+// Writes the program as little-endian words, returns the number of
+// instructions that could not be encoded (written as NOP)
+int assembleProgram(const Inputs *inputs, FILE *file) {
+	OutputBuffer out;
+	int failed = 0;
+
+	outputInit(&out, file);
+	for (int i = 0; i < inputs->instructions_count; i++) {
+		uint32_t word;
+		unsigned char bytes[4];
+
+		if (encodeInstruction(&inputs->instructions[i], i, &word) != 0) {
+			errorf("Instruction %d cannot be encoded\n", i);
+			word = 0xD503201F;
+			failed++;
+		}
+		for (int b = 0; b < 4; b++)
+			bytes[b] = (unsigned char)(word >> (8 * b));
+		outputWrite(&out, (const char *)bytes, sizeof bytes);
+	}
+	outputFree(&out);
+
+	return failed;
+}
+
+// }}}
+
+// {{{ Decoder
+
+static char *formatImmediate(Arena *arena, int64_t value) {
+	char text[24];
+	int length = snprintf(text, sizeof text, "%lld", (long long)value);
+
+	return arenaStrndup(arena, text, (size_t)length);
+}
+
+static inline int64_t signExtend(uint32_t value, int bits) {
+	return (int64_t)((uint64_t)value << (64 - bits)) >> (64 - bits);
+}
+
+// Decodes one word. Immediates become text like the parser produces, and
+// branch offsets are left for resolveBranchTargets. Returns -1 when no
+// encoding matches.
+int decodeInstruction(uint32_t word, Instruction *ins, Arena *arena) {
+	uint32_t prefix = word >> (32 - DECODE_PRIMARY_BITS);
+	const Encoding *encoding = NULL;
+
+	for (uint32_t c = decode_first[prefix]; c < decode_first[prefix + 1];
+		 c++) {
+		const Encoding *candidate = &encodings[decode_candidates[c]];
+		if ((word & candidate->mask) == candidate->match) {
+			encoding = candidate;
+			break;
+		}
+	}
+
+	if (encoding == NULL)
+		return -1;
+
+	Register rd = (Register)(word & 0x1F);
+	Register rn = (Register)((word >> 5) & 0x1F);
+	Register rm = (Register)((word >> 16) & 0x1F);
+	uint32_t shamt = (word >> 10) & 0x3F;
+
+	memset(ins, 0, sizeof *ins);
+	ins->type = encoding->op;
+	ins->format = instruction_formats[encoding->op];
+	ins->target = -1;
+
+	switch (encoding->layout) {
+
+	case LAYOUT_R:
+	case LAYOUT_COMPARE:
+		ins->values.R = (RVals){rd, rn, rm, NULL};
+		if (shamt != 0)
+			ins->values.R.shamt = formatImmediate(arena, shamt);
+		break;
+
+	case LAYOUT_RM:
+		ins->values.R = (RVals){rd, rn, rm, NULL};
+		break;
+
+	case LAYOUT_SHIFT:
+		ins->values.R =
+			(RVals){rd, rn, REG_NONE, formatImmediate(arena, shamt)};
+		break;
+
+	case LAYOUT_IMMR:
+		ins->values.R = (RVals){rd, rn, REG_NONE,
+								formatImmediate(arena, (word >> 16) & 0x3F)};
+		break;
+
+	case LAYOUT_EXTEND:
+		ins->values.R = (RVals){rd, rn, REG_NONE, NULL};
+		break;
+
+	case LAYOUT_MOVE:
+		ins->values.IM = (IMVals){rd, rm, NULL, NULL};
+		break;
+
+	case LAYOUT_JUMP:
+		if (ins->format == B_TYPE)
+			ins->values.B = (BVals){rn, NULL};
+		else
+			ins->values.R = (RVals){REG_NONE, rn, REG_NONE, NULL};
+		break;
+
+	case LAYOUT_I:
+	case LAYOUT_COMPARE_I:
+		ins->values.I =
+			(IVals){rd, rn, formatImmediate(arena, (word >> 10) & 0xFFF)};
+		break;
+
+	case LAYOUT_D:
+		ins->values.D = (DVals){
+			rd, rn,
+			formatImmediate(arena, signExtend((word >> 12) & 0x1FF, 9))};
+		break;
+
+	case LAYOUT_B:
+		ins->values.B = (BVals){
+			REG_NONE, formatImmediate(arena, signExtend(word & 0x3FFFFFF, 26))};
+		break;
+
+	case LAYOUT_CB:
+		ins->values.CB = (CBVals){
+			rd, formatImmediate(arena, signExtend((word >> 5) & 0x7FFFF, 19))};
+		break;
+
+	case LAYOUT_COND:
+		ins->values.B = (BVals){
+			REG_NONE,
+			formatImmediate(arena, signExtend((word >> 5) & 0x7FFFF, 19))};
+		break;
+
+	case LAYOUT_IM: {
+		uint32_t hw = (word >> 21) & 3;
+		ins->values.IM =
+			(IMVals){rd, REG_NONE, formatImmediate(arena, (word >> 5) & 0xFFFF),
+					 hw != 0 ? formatImmediate(arena, hw * 16) : NULL};
+		break;
+	}
+
+	case LAYOUT_NONE:
+		ins->values.R = (RVals){REG_NONE, REG_NONE, REG_NONE, NULL};
+		break;
+	}
+
+	computeRegisterMasks(ins);
+	return 0;
+}
+
+// }}}
+
+/*
+ *  Input and Output
+ */
+
+// {{{ Log Parsed Instruction
+
+void printInstruction(const Instruction *ins) {
+	if (ins->type != NUM_INSTRUCTIONS)
+		infof("\033[1mOpcode\033[0m = %d\n", ins->type);
+
+	switch (ins->format) {
+
+	case R_TYPE:
+		infof("\033[1mFormat\033[0m = R_TYPE\n");
+		infof("\033[1mrd\033[0m = %s\n", registerName(ins->values.R.rd));
+		infof("\033[1mrn\033[0m = %s\n", registerName(ins->values.R.rn));
+		infof("\033[1mrm\033[0m = %s\n", registerName(ins->values.R.rm));
+		infof("\033[1mshamt\033[0m = %s\n", ins->values.R.shamt);
+		break;
+
+	case I_TYPE:
+		infof("\033[1mFormat\033[0m = I_TYPE\n");
+		infof("\033[1mrd\033[0m = %s\n", registerName(ins->values.I.rd));
+		infof("\033[1mrn\033[0m = %s\n", registerName(ins->values.I.rn));
+		infof("\033[1mimm12\033[0m = %s\n", ins->values.I.imm12);
+		break;
+
+	case D_TYPE:
+		infof("\033[1mFormat\033[0m = D_TYPE\n");
+		infof("\033[1mrt\033[0m = %s\n", registerName(ins->values.D.rt));
+		infof("\033[1mrn\033[0m = %s\n", registerName(ins->values.D.rn));
+		infof("\033[1maddr9\033[0m = %s\n", ins->values.D.addr9);
+		break;
+
+	case B_TYPE:
+		infof("\033[1mFormat\033[0m = B_TYPE\n");
+		infof("\033[1mrn\033[0m = %s\n", registerName(ins->values.B.rn));
+		infof("\033[1mimm26\033[0m = %s\n", ins->values.B.imm26);
+		break;
+
+	case CB_TYPE:
+		infof("\033[1mFormat\033[0m = CB_TYPE\n");
+		infof("\033[1mrt\033[0m = %s\n", registerName(ins->values.CB.rt));
+		infof("\033[1mimm19\033[0m = %s\n", ins->values.CB.imm19);
+		break;
+
+	case IM_TYPE:
+		infof("\033[1mFormat\033[0m = IM_TYPE\n");
+		infof("\033[1mrd\033[0m = %s\n", registerName(ins->values.IM.rd));
+		infof("\033[1mrn\033[0m = %s\n", registerName(ins->values.IM.rn));
+		infof("\033[1mimm16\033[0m = %s\n", ins->values.IM.imm16);
+		infof("\033[1msh\033[0m = %s\n", ins->values.IM.sh);
+		break;
+
+	default:
+		errorf("Unknown Format\n");
+		break;
+	}
+}
+
+// }}}
+
+// {{{ Get Inputs
+
+void getUserInputs(Inputs *inputs, unsigned int log) {
+	printf("\n\033[1mNumber of Instructions: \033[0m");
+	scanf("%d", &inputs->instructions_count);
+	printf("\n");
+
+	if (inputs->instructions_count < 0)
+		inputs->instructions_count = 0;
+
+	int count = inputs->instructions_count;
+
+	arenaReset(&inputs->arena);
+	inputs->symbols = (SymbolTable){0};
+	inputs->instructions =
+		(Instruction *)arenaAlloc(&inputs->arena, count * sizeof(Instruction));
+	inputs->instructions_count = 0;
+
+	// A line holding only a label does not use up an instruction
+	while (inputs->instructions_count < count) {
+		char instruction_unparsed[64];
+		int i = inputs->instructions_count;
+
+		printf("\033[1m%i ->\033[0m ", i + 1);
+		if (scanf(" %63[^\n]", instruction_unparsed) != 1)
+			break;
+
+		char *text = (char *)parseLabels(
+			inputs, instruction_unparsed,
+			instruction_unparsed + strlen(instruction_unparsed));
+		if (*text == '\0')
+			continue;
+
+		inputs->instructions[i] =
+			parseInstructionFromUser(text, &inputs->arena);
+
+		if (log == 1)
+			printInstruction(&inputs->instructions[i]);
+
+		inputs->instructions_count++;
+	}
+
+	resolveBranchTargets(inputs);
+
+	printf("\n");
+}
+
+// }}}
+
+// {{{ Configure Pipeline
+
+void configurePipeline(PipelineConfig *config) {
+	unsigned int choice = 0;
+
+	printf("\n\033[1mForwarding (currently %s)\033[0m\n",
+		   forwardingName(config));
+	printf("\033[1m1 ->\033[0m Full (EX/MEM and MEM/WB)\n");
+	printf("\033[1m2 ->\033[0m EX/MEM only\n");
+	printf("\033[1m3 ->\033[0m MEM/WB only\n");
+	printf("\033[1m4 ->\033[0m None\n");
+	printf("\n\033[1mEnter selection: \033[0m");
+
+	if (scanf("%u", &choice) == 1 && choice >= 1 && choice <= 4) {
+		config->forward_ex_mem = choice == 1 || choice == 2;
+		config->forward_mem_wb = choice == 1 || choice == 3;
+	} else {
+		errorf("Not a valid choice, keeping %s\n", forwardingName(config));
+		while (getchar() != '\n') {
+		}
+	}
+
+	printf("\n\033[1mWrite register file before read in the same cycle "
+		   "(currently %s)\033[0m\n",
+		   config->split_register_file ? "yes" : "no");
+	printf("\033[1m1 ->\033[0m Yes\n");
+	printf("\033[1m2 ->\033[0m No\n");
+	printf("\n\033[1mEnter selection: \033[0m");
+
+	if (scanf("%u", &choice) == 1 && choice >= 1 && choice <= 2) {
+		config->split_register_file = choice == 1;
+	} else {
+		errorf("Not a valid choice, keeping current setting\n");
+		while (getchar() != '\n') {
+		}
+	}
+
+	printf("\n\033[1mBranch handling (currently %s)\033[0m\n",
+		   branch_policy_names[config->branch_policy]);
+	for (int i = 0; i < NUM_BRANCH_POLICIES; i++)
+		printf("\033[1m%d ->\033[0m %s\n", i + 1, branch_policy_names[i]);
+	printf("\n\033[1mEnter selection: \033[0m");
+
+	if (scanf("%u", &choice) == 1 && choice >= 1 &&
+		choice <= NUM_BRANCH_POLICIES) {
+		config->branch_policy = (uint8_t)(choice - 1);
+	} else {
+		errorf("Not a valid choice, keeping %s\n",
+			   branch_policy_names[config->branch_policy]);
+		while (getchar() != '\n') {
+		}
+	}
+
+	if (config->branch_policy != BRANCH_IDEAL) {
+		printf("\n\033[1mMispredict penalty in cycles (currently %d): "
+			   "\033[0m",
+			   config->mispredict_penalty);
+
+		if (scanf("%u", &choice) == 1 && choice <= 255) {
+			config->mispredict_penalty = (uint8_t)choice;
+		} else {
+			errorf("Not a valid penalty, keeping %d\n",
+				   config->mispredict_penalty);
+			while (getchar() != '\n') {
+			}
+		}
+	}
+
+	char geometry[64];
+
+	printf("\n\033[1mData cache as size:ways:line, 0 for none (currently ");
+	if (config->cache.size != 0)
+		printf("%u:%u:%u", config->cache.size, config->cache.ways,
+			   config->cache.line_size);
+	else
+		printf("none");
+	printf("): \033[0m");
+
+	if (scanf("%63s", geometry) != 1 ||
+		setCacheGeometry(config, geometry) != 0) {
+		errorf("Not a valid cache, keeping the current one\n");
+		while (getchar() != '\n') {
+		}
+	}
+
+	if (config->cache.size != 0) {
+		printf("\n\033[1mMiss latency in cycles (currently %d): \033[0m",
+			   config->cache.miss_latency);
+
+		if (scanf("%u", &choice) == 1 && choice <= 65535) {
+			config->cache.miss_latency = (uint16_t)choice;
+		} else {
+			errorf("Not a valid latency, keeping %d\n",
+				   config->cache.miss_latency);
+			while (getchar() != '\n') {
+			}
+		}
+	}
+
+	printf("\n\033[1mInstructions issued per cycle, 1-%d (currently %d): "
+		   "\033[0m",
+		   MAX_ISSUE_WIDTH, config->issue_width);
+
+	if (scanf("%u", &choice) == 1 && choice >= 1 &&
+		choice <= MAX_ISSUE_WIDTH) {
+		config->issue_width = (uint8_t)choice;
+	} else {
+		errorf("Not a valid width, keeping %d\n", config->issue_width);
+		while (getchar() != '\n') {
+		}
+	}
+
+	printf("\n\033[1mOut-of-order core (currently %s)\033[0m\n",
+		   config->out_of_order ? "yes" : "no");
+	printf("\033[1m1 ->\033[0m Yes (Tomasulo with a reorder buffer)\n");
+	printf("\033[1m2 ->\033[0m No (in-order 5-stage pipeline)\n");
+	printf("\n\033[1mEnter selection: \033[0m");
+
+	if (scanf("%u", &choice) == 1 && choice >= 1 && choice <= 2) {
+		config->out_of_order = choice == 1;
+	} else {
+		errorf("Not a valid choice, keeping current setting\n");
+		while (getchar() != '\n') {
+		}
+	}
+
+	if (config->out_of_order) {
+		printf("\n\033[1mReorder buffer entries (currently %d): \033[0m",
+			   config->rob_size);
+
+		if (scanf("%u", &choice) == 1 && choice >= 1 &&
+			choice <= MAX_ROB_SIZE) {
+			config->rob_size = (uint16_t)choice;
+		} else {
+			errorf("Not a valid size, keeping %d\n", config->rob_size);
+			while (getchar() != '\n') {
+			}
+		}
+	}
+
+	printf("\n\033[1mMulti-cycle functional units (currently %s)\033[0m\n",
+		   config->functional_units ? "yes" : "no");
+	printf("\033[1m1 ->\033[0m Yes (MUL %d cycles, DIV %d unpipelined)\n",
+		   instruction_latencies[MUL], instruction_latencies[SDIV]);
+	printf("\033[1m2 ->\033[0m No (every EX takes one cycle)\n");
+	printf("\n\033[1mEnter selection: \033[0m");
+
+	if (scanf("%u", &choice) == 1 && choice >= 1 && choice <= 2) {
+		config->functional_units = choice == 1;
+	} else {
+		errorf("Not a valid choice, keeping current setting\n");
+		while (getchar() != '\n') {
+		}
+	}
 
-void getUserInputs(Inputs *inputs, unsigned int log) {
-	printf("\n\033[1mNumber of Instructions: \033[0m");
-	scanf("%d", &inputs->instructions_count);
 	printf("\n");
+}
+
+// }}}
+
+// {{{ Load From File
+
+// Maps the whole file (or slurps stdin when it is a pipe) so the program can
+// be parsed in a single pass without a prompt per line
+static char *readSource(const char *path, size_t *len, int *mapped) {
+	int fd = 0;
+	struct stat st;
+
+	if (strcmp(path, "-") != 0) {
+		fd = open(path, O_RDONLY);
+		if (fd < 0) {
+			errorf("Could not open %s\n", path);
+			return NULL;
+		}
+	}
+
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+		*len = (size_t)st.st_size;
+		*mapped = 1;
+
+		if (*len == 0) {
+			if (fd != 0)
+				close(fd);
+			return NULL;
+		}
+
+		char *data = mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (fd != 0)
+			close(fd);
+
+		if (data == MAP_FAILED) {
+			errorf("Could not map %s\n", path);
+			return NULL;
+		}
+		madvise(data, *len, MADV_SEQUENTIAL);
+		return data;
+	}
+
+	size_t cap = 1 << 16;
+	char *data = malloc(cap);
+	ssize_t got;
+
+	*len = 0;
+	*mapped = 0;
+	while ((got = read(fd, data + *len, cap - *len)) > 0) {
+		*len += (size_t)got;
+		if (*len == cap) {
+			cap *= 2;
+			data = realloc(data, cap);
+		}
+	}
+
+	if (fd != 0)
+		close(fd);
+	return data;
+}
+
+int loadInputsFromFile(Inputs *inputs, const char *path, unsigned int log) {
+	size_t len = 0;
+	int mapped = 0;
+	char *data = readSource(path, &len, &mapped);
+
+	inputs->instructions_count = 0;
+	inputs->instructions = NULL;
+
+	if (data == NULL)
+		return len == 0 && mapped ? 0 : -1;
+
+	// Count lines first so the instruction array is allocated exactly once
+	size_t lines = 1;
+	for (const char *p = data; (p = memchr(p, '\n', data + len - p)) != NULL;
+		 p++)
+		lines++;
+
+	// Instructions and operand text for the whole file land in one block
+	arenaReset(&inputs->arena);
+	inputs->symbols = (SymbolTable){0};
+	arenaReserve(&inputs->arena, lines * sizeof(Instruction) + len + lines * 4);
+	inputs->instructions =
+		(Instruction *)arenaAlloc(&inputs->arena, lines * sizeof(Instruction));
+
+	const char *p = data;
+	const char *end = data + len;
+
+	while (p < end) {
+		const char *eol = memchr(p, '\n', end - p);
+		if (eol == NULL)
+			eol = end;
+
+		// Drop the comment; the lexer skips whitespace and carriage returns
+		const char *stop = eol;
+		for (const char *c = p; (c = memchr(c, '/', stop - c)) != NULL; c++) {
+			if (c + 1 < stop && c[1] == '/') {
+				stop = c;
+				break;
+			}
+		}
+
+		Token tokens[MAX_LINE_TOKENS];
+		int count = lexLine(p, (size_t)(stop - p), (size_t)(end - p), tokens,
+							MAX_LINE_TOKENS);
+		int labels = defineLabelTokens(inputs, tokens, count, stop);
+
+		p = eol + 1;
+		if (labels == count)
+			continue;
+
+		inputs->instructions[inputs->instructions_count] =
+			parseInstructionTokens(tokens + labels, count - labels,
+								   &inputs->arena);
+
+		if (log == 1)
+			printInstruction(
+				&inputs->instructions[inputs->instructions_count]);
+
+		inputs->instructions_count++;
+	}
+
+	if (mapped)
+		munmap(data, len);
+	else
+		free(data);
+
+	resolveBranchTargets(inputs);
+
+	return 0;
+}
+
+// Loads little-endian LEGv8 machine words, one instruction per word
+int loadInputsFromBinary(Inputs *inputs, const char *path, unsigned int log) {
+	size_t len = 0;
+	int mapped = 0;
+	char *data = readSource(path, &len, &mapped);
+
+	inputs->instructions_count = 0;
+	inputs->instructions = NULL;
+
+	if (data == NULL)
+		return len == 0 && mapped ? 0 : -1;
+
+	if (len % 4 != 0)
+		errorf("%s is not a whole number of words, ignoring the last %zu "
+			   "bytes\n",
+			   path, len % 4);
+
+	size_t count = len / 4;
+	const unsigned char *bytes = (const unsigned char *)data;
+
+	// Every immediate becomes at most a 24-byte string
+	arenaReset(&inputs->arena);
+	inputs->symbols = (SymbolTable){0};
+	arenaReserve(&inputs->arena, count * (sizeof(Instruction) + 48));
+	inputs->instructions =
+		(Instruction *)arenaAlloc(&inputs->arena, count * sizeof(Instruction));
+
+	for (size_t i = 0; i < count; i++) {
+		Instruction *ins = &inputs->instructions[i];
+		uint32_t word = (uint32_t)bytes[4 * i] |
+						(uint32_t)bytes[4 * i + 1] << 8 |
+						(uint32_t)bytes[4 * i + 2] << 16 |
+						(uint32_t)bytes[4 * i + 3] << 24;
+
+		if (decodeInstruction(word, ins, &inputs->arena) != 0) {
+			errorf("Unknown machine word 0x%08x at instruction %zu\n", word,
+				   i);
+			memset(ins, 0, sizeof *ins);
+			ins->type = NUM_INSTRUCTIONS;
+			ins->format = UNKNOWN_TYPE;
+			ins->target = -1;
+		}
+
+		if (log == 1)
+			printInstruction(ins);
+	}
+	inputs->instructions_count = (int)count;
+
+	if (mapped)
+		munmap(data, len);
+	else
+		free(data);
+
+	resolveBranchTargets(inputs);
+
+	return 0;
+}
 
-	inputs->instructions =
-		(Instruction *)malloc(inputs->instructions_count * sizeof(Instruction));
+// Machine code is recognised by a .bin suffix or forced with `binary`
+int loadInputs(Inputs *inputs, const char *path, unsigned int binary,
+			   unsigned int log) {
+	size_t length = strlen(path);
 
-	for (int i = 1; i <= inputs->instructions_count; i++) {
-		char instruction_unparsed[64];
+	if (binary || (length > 4 && strcmp(path + length - 4, ".bin") == 0))
+		return loadInputsFromBinary(inputs, path, log);
+	return loadInputsFromFile(inputs, path, log);
+}
+
+// }}}
 
-		printf("\033[1m%i ->\033[0m ", i);
-		scanf(" %[^\n]", instruction_unparsed);
+// {{{ Stream Analysis
 
-		inputs->instructions[i - 1] =
-			parseInstructionFromUser(instruction_unparsed);
+// Analyses a listing of unknown length read from a file or pipe, such as a
+// trace written by another tool, without ever holding it. The engine keeps
+// all the hazard state in its scoreboard, so each instruction is parsed,
+// stepped and, with --export, written out before the next one is read.
+// Input goes through a fixed buffer, and the operand text of the last
+// STREAM_ARENA_RESET instructions through an arena that is then reset, so
+// memory stays the same however long the stream runs.
+//
+// As in a listing, conditional branches fall through and the others are
+// taken. Labels are skipped, since a branch to one may come before it; such
+// a branch has no target. Indices wrap every STREAM_PC_PERIOD instructions,
+// which keeps offset targets in 32 bits and predictor slots unchanged.
+#define STREAM_BUFFER (1 << 16)
+#define STREAM_ARENA_RESET 4096
+#define STREAM_PC_PERIOD (1u << 29)
 
-		if (log == 1)
-			printInstruction(&inputs->instructions[i - 1]);
+static void streamStep(Analysis *analysis, HazardEngine *engine,
+					   Instruction *ins, TimelineExporter *exporter) {
+	uint64_t row = analysis->instructions_count;
+	uint32_t pc = (uint32_t)(row % STREAM_PC_PERIOD) + STREAM_PC_PERIOD;
+	const char *operand = branchOperand(ins);
+
+	ins->target = -1;
+	if (operand != NULL && isOffsetOperand(operand))
+		ins->target = (int32_t)pc + (int32_t)strtol(operand, NULL, 0);
+
+	InstructionTiming timing =
+		hazardEngineStep(engine, ins, pc, !isConditionalBranch(*ins), 0);
+
+	if (exporter != NULL)
+		exporterRow(exporter, (uint32_t)row, ins, &timing);
+	analysis->instructions_count++;
+	analysisAccumulate(analysis, &timing);
+}
+
+// Parses one line of the stream; returns 1 if it held an instruction
+static int streamLine(Instruction *ins, const char *p, const char *eol,
+					  const char *end, Arena *arena) {
+	const char *stop = eol;
+
+	for (const char *c = p; (c = memchr(c, '/', stop - c)) != NULL; c++) {
+		if (c + 1 < stop && c[1] == '/') {
+			stop = c;
+			break;
+		}
 	}
 
-	printf("\n");
+	Token tokens[MAX_LINE_TOKENS];
+	int count = lexLine(p, (size_t)(stop - p), (size_t)(end - p), tokens,
+						MAX_LINE_TOKENS);
+	int labels = 0;
+
+	while (labels < count) {
+		const char *after = tokens[labels].start + tokens[labels].length;
+
+		if (after >= stop || *after != ':')
+			break;
+		labels++;
+	}
+	if (labels == count)
+		return 0;
+
+	*ins = parseInstructionTokens(tokens + labels, count - labels, arena);
+	return 1;
+}
+
+int analyzeStream(Analysis *analysis, const char *path, unsigned int binary,
+				  const PipelineConfig *config, unsigned int log,
+				  TimelineExporter *exporter) {
+	int fd = 0;
+
+	if (strcmp(path, "-") != 0 && (fd = open(path, O_RDONLY)) < 0) {
+		errorf("Could not open %s\n", path);
+		return -1;
+	}
+
+	char *buffer = malloc(STREAM_BUFFER);
+	Arena arena = {0};
+	HazardEngine engine;
+	Instruction ins;
+	size_t used = 0;
+	size_t length = strlen(path);
+	int done = 0;
+
+	// Machine code is recognised the same way as for -f
+	if (length > 4 && strcmp(path + length - 4, ".bin") == 0)
+		binary = 1;
+
+	analysisFree(analysis);
+	analysis->streamed = 1;
+	hazardEngineInit(&engine, config);
+
+	while (!done) {
+		ssize_t got = read(fd, buffer + used, STREAM_BUFFER - used);
+
+		if (got > 0)
+			used += (size_t)got;
+		else
+			done = 1;
+
+		const char *p = buffer;
+		const char *end = buffer + used;
+
+		while (p < end) {
+			int parsed;
+
+			if (binary) {
+				if (end - p < 4)
+					break;
+
+				const unsigned char *bytes = (const unsigned char *)p;
+				uint32_t word = (uint32_t)bytes[0] |
+								(uint32_t)bytes[1] << 8 |
+								(uint32_t)bytes[2] << 16 |
+								(uint32_t)bytes[3] << 24;
+
+				if (decodeInstruction(word, &ins, &arena) != 0) {
+					errorf("Unknown machine word 0x%08x at instruction "
+						   "%llu\n",
+						   word,
+						   (unsigned long long)analysis->instructions_count);
+					memset(&ins, 0, sizeof ins);
+					ins.type = NUM_INSTRUCTIONS;
+					ins.format = UNKNOWN_TYPE;
+				}
+				parsed = 1;
+				p += 4;
+			} else {
+				const char *eol = memchr(p, '\n', end - p);
+
+				// Keep a partial line for the next read unless it fills the
+				// whole buffer or nothing more is coming
+				if (eol == NULL && !done &&
+					(p != buffer || used < STREAM_BUFFER))
+					break;
+				if (eol == NULL) {
+					if (!done)
+						errorf("Line %llu is longer than %d bytes, splitting "
+							   "it\n",
+							   (unsigned long long)analysis->instructions_count,
+							   STREAM_BUFFER);
+					eol = end;
+				}
+
+				parsed = streamLine(&ins, p, eol, end, &arena);
+				p = eol < end ? eol + 1 : end;
+			}
+
+			if (!parsed)
+				continue;
+			if (log == 1)
+				printInstruction(&ins);
+			streamStep(analysis, &engine, &ins, exporter);
+
+			// Nothing refers to older operand text any more
+			if (analysis->instructions_count % STREAM_ARENA_RESET == 0)
+				arenaReset(&arena);
+		}
+
+		used = (size_t)(end - p);
+		memmove(buffer, p, used);
+	}
+
+	if (binary && used != 0)
+		errorf("%s is not a whole number of words, ignoring the last %zu "
+			   "bytes\n",
+			   path, used);
+
+	analysisFinish(analysis, &engine);
+	analysis->multicycle = config->functional_units;
+	analysis->issue_width = config->issue_width;
+	analysis->out_of_order = config->out_of_order;
+
+	hazardEngineFree(&engine);
+	arenaFree(&arena);
+	free(buffer);
+	if (fd != 0)
+		close(fd);
+	return 0;
 }
 
 // }}}
 
 // {{{ Print Functions
 
-void printChart(Inputs ins) {
-	int stalls = 0;
-	printf("\n\033[32m\033[1mChart of pipelined stages:\n\n");
-	for (int i = 0; i < ins.instructions_count; i++) {
+// Which rows of the chart to draw and how. A window_count of 0 means every
+// row from window_start on. Compact mode prints the IF cycle as a number
+// instead of indenting the row.
+typedef struct {
+	uint64_t window_start, window_count;
+	uint8_t compact;
+} ChartOptions;
+
+// Accepts start:count
+int parseChartWindow(ChartOptions *options, const char *text) {
+	char *end;
+
+	options->window_start = strtoull(text, &end, 0);
+	if (*end != ':')
+		return -1;
+	options->window_count = strtoull(end + 1, &end, 0);
+	return *end == '\0' ? 0 : -1;
+}
+
+void printChart(const Analysis *analysis, const ChartOptions *options,
+				FILE *file) {
+	static const char stages[] = "|IF  |ID  |EX  |ME  |WB  |\n";
+	uint64_t first = options->window_start;
+	uint64_t last = analysis->instructions_count;
+	OutputBuffer out;
+
+	if (analysis->timings == NULL && analysis->instructions_count > 0) {
+		errorf("Per-instruction timings were not kept for this run\n");
+		return;
+	}
+
+	if (first > last)
+		first = last;
+	if (options->window_count != 0 && options->window_count < last - first)
+		last = first + options->window_count;
+
+	fflush(stdout);
+	outputInit(&out, file);
+	outputString(&out, "\n\033[32m\033[1mChart of pipelined stages:\n\n");
+
+	// A window is drawn relative to its first row so it does not start with
+	// thousands of columns of padding
+	uint64_t base = first < last ? analysis->timings[first].issue_cycle : 0;
+	if (first > 0 || last < analysis->instructions_count) {
+		outputString(&out, "Instructions ");
+		outputUnsigned(&out, first, 0);
+		outputString(&out, " to ");
+		outputUnsigned(&out, last > first ? last - 1 : first, 0);
+		outputString(&out, ", starting at cycle ");
+		outputUnsigned(&out, base, 0);
+		outputString(&out, "\n\n");
+	}
+
+	for (uint64_t i = first; i < last; i++) {
+		uint64_t cycle = analysis->timings[i].issue_cycle;
+
+		if (options->compact) {
+			outputUnsigned(&out, cycle, 10);
+			outputWrite(&out, " ", 1);
+		} else {
+			outputRepeat(&out, ' ', (cycle - base) * 5);
+		}
+		const InstructionTiming *timing = &analysis->timings[i];
+		if (timing->memory_stalls == 0 && timing->execute_extra == 0 &&
+			timing->queue_cycles == 0 && timing->retire_cycles == 0) {
+			outputWrite(&out, stages, sizeof stages - 1);
+		} else {
+			// EX repeats for every extra cycle on a multi-cycle unit, ME for
+			// every cycle spent waiting on the cache. Out of order, RS marks
+			// the wait in a reservation station and ROB the wait to commit.
+			outputWrite(&out, stages, 11);
+			for (uint32_t k = 0; k < timing->queue_cycles; k++)
+				outputWrite(&out, "RS  |", 5);
+			outputWrite(&out, stages + 11, 5);
+			for (uint32_t k = 0; k < timing->execute_extra; k++)
+				outputWrite(&out, "EX  |", 5);
+			outputWrite(&out, stages + 16, 5);
+			for (uint32_t k = 0; k < timing->memory_stalls; k++)
+				outputWrite(&out, "ME  |", 5);
+			for (uint32_t k = 0; k < timing->retire_cycles; k++)
+				outputWrite(&out, "ROB |", 5);
+			outputWrite(&out, stages + 21, sizeof stages - 22);
+		}
+	}
+
+	outputString(&out, "\033[0m\n");
+	outputFree(&out);
+}
+
+// One line per cycle with the instructions that entered IF in it, so the
+// width of each issue group shows at a glance. Cycles where nothing issued
+// are drawn empty.
+void printIssueGroups(const Analysis *analysis, const Inputs *inputs,
+					  const ChartOptions *options, FILE *file) {
+	uint64_t first = options->window_start;
+	uint64_t last = analysis->instructions_count;
+	OutputBuffer out;
+
+	if (analysis->timings == NULL && analysis->instructions_count > 0) {
+		errorf("Per-instruction timings were not kept for this run\n");
+		return;
+	}
+
+	if (first > last)
+		first = last;
+	if (options->window_count != 0 && options->window_count < last - first)
+		last = first + options->window_count;
+
+	fflush(stdout);
+	outputInit(&out, file);
+	outputString(&out, "\n\033[32m\033[1mChart of issue groups:\n\n");
+	outputString(&out, "     cycle | issue group\n");
+
+	uint64_t cycle = first < last ? analysis->timings[first].issue_cycle : 0;
+	for (uint64_t i = first; i < last;) {
+		outputUnsigned(&out, cycle, 10);
+		outputString(&out, " |");
+
+		for (; i < last && analysis->timings[i].issue_cycle == cycle; i++) {
+			uint32_t index = analysis->indices != NULL ? analysis->indices[i]
+													   : (uint32_t)i;
+			Opcode op = inputs->instructions[index].type;
+			const char *mnemonic =
+				op < NUM_INSTRUCTIONS ? instruction_mnemonics[op] : "?";
+			size_t length = strlen(mnemonic);
+
+			outputWrite(&out, mnemonic, length);
+			outputRepeat(&out, ' ', length < 7 ? 7 - length : 1);
+			outputWrite(&out, "|", 1);
+		}
+		outputWrite(&out, "\n", 1);
+		cycle++;
+	}
+
+	outputString(&out, "\033[0m\n");
+	outputFree(&out);
+}
+
+void printTotalCycleCount(const Analysis *analysis) {
+	uint64_t branch_stalls = analysis->stalls_by_reason[HAZARD_BRANCH];
+	uint64_t memory_stalls = analysis->stalls_by_reason[HAZARD_MEMORY];
+	uint64_t structural_stalls =
+		analysis->stalls_by_reason[HAZARD_STRUCTURAL];
+
+	printf("\n\033[1m\033[32mTotal Cycle Count: %llu\033[0m\n",
+		   (unsigned long long)analysis->total_cycles);
+	if (analysis->executed)
+		printf("\033[32mExecuted Instructions: %llu (%s)\033[0m\n",
+			   (unsigned long long)analysis->instructions_count,
+			   analysis->halted ? "halted" : "step limit reached");
+	if (analysis->streamed)
+		printf("\033[32mStreamed Instructions: %llu\033[0m\n",
+			   (unsigned long long)analysis->instructions_count);
+	if (analysis->issue_width > 1 || analysis->out_of_order)
+		printf("\033[32mIPC: %.3f (%d-wide %s)\033[0m\n",
+			   analysis->total_cycles != 0
+				   ? (double)analysis->instructions_count /
+						 (double)analysis->total_cycles
+				   : 0.0,
+			   analysis->issue_width,
+			   analysis->out_of_order ? "out-of-order" : "issue");
+	printf("\033[32mData Stalls: %llu\033[0m\n",
+		   (unsigned long long)(analysis->stalls - branch_stalls -
+								memory_stalls - structural_stalls));
+	printf("\033[32mBranch Stalls: %llu (%llu of %llu branches "
+		   "mispredicted)\033[0m\n",
+		   (unsigned long long)branch_stalls,
+		   (unsigned long long)analysis->mispredictions,
+		   (unsigned long long)analysis->branches);
+	if (analysis->multicycle || analysis->out_of_order)
+		printf("\033[32mStructural Stalls: %llu\033[0m\n",
+			   (unsigned long long)structural_stalls);
+	if (analysis->cached)
+		printf("\033[32mMemory Stalls: %llu (%llu of %llu accesses missed, "
+			   "%llu write-backs)\033[0m\n",
+			   (unsigned long long)memory_stalls,
+			   (unsigned long long)analysis->cache_misses,
+			   (unsigned long long)analysis->cache_accesses,
+			   (unsigned long long)analysis->cache_writebacks);
+	printf("\n");
+}
+
+// }}}
+
+/*
+ *  Benchmarks
+ */
+
+// {{{ Program Generator
+
+// Shape of a synthetic program. Densities are fractions of all instructions.
+// Every ALU result and load reads a register written dependency_distance
+// instructions earlier; branches only jump forward so -x always terminates.
+typedef struct {
+	uint64_t size;
+	double load_density;
+	double store_density;
+	double branch_ratio;
+	uint32_t dependency_distance;
+	uint64_t seed;
+} GeneratorOptions;
+
+#define GENERATOR_OPTIONS_DEFAULT                                              \
+	{                                                                          \
+		.size = 1000, .load_density = 0.2, .store_density = 0.1,               \
+		.branch_ratio = 0.1, .dependency_distance = 2, .seed = 1,              \
+	}
+
+// Destinations rotate through X0-X15, which bounds the dependency distance
+#define GENERATOR_REGISTERS 16
+
+// xorshift64*
+static uint64_t nextRandom(uint64_t *state) {
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 0x2545F4914F6CDD1Dull;
+}
+
+// Uniform in [0, 1)
+static double randomFraction(uint64_t *state) {
+	return (double)(nextRandom(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void outputRegister(OutputBuffer *out, unsigned r) {
+	outputWrite(out, "X", 1);
+	outputUnsigned(out, r, 0);
+}
+
+void generateProgram(const GeneratorOptions *options, OutputBuffer *out) {
+	static const char *alu_ops[] = {"ADD", "SUB", "AND", "ORR", "EOR"};
+	static const char *branch_ops[] = {"CBZ", "CBNZ"};
+	uint64_t state = options->seed * 0x9E3779B97F4A7C15ull | 1;
+	unsigned distance = options->dependency_distance;
+
+	for (uint64_t i = 0; i < options->size; i++) {
+		unsigned rd = (unsigned)(i % GENERATOR_REGISTERS);
+		unsigned rn = (unsigned)((i + GENERATOR_REGISTERS - distance) %
+								 GENERATOR_REGISTERS);
+		unsigned rm = (unsigned)(nextRandom(&state) % GENERATOR_REGISTERS);
+		uint64_t offset = (nextRandom(&state) % 32) * 8;
+		double pick = randomFraction(&state);
+
+		if (pick < options->branch_ratio) {
+			// Forward by 1-4 instructions
+			uint64_t target = 1 + nextRandom(&state) % 4;
+			if (nextRandom(&state) % 4 == 0) {
+				outputString(out, "B ");
+			} else {
+				outputString(out, branch_ops[nextRandom(&state) % 2]);
+				outputWrite(out, " ", 1);
+				outputRegister(out, rn);
+				outputString(out, ", ");
+			}
+			outputUnsigned(out, target, 0);
+		} else if ((pick -= options->branch_ratio) < options->load_density) {
+			outputString(out, "LDUR ");
+			outputRegister(out, rd);
+			outputString(out, ", [SP, #");
+			outputUnsigned(out, offset, 0);
+			outputWrite(out, "]", 1);
+		} else if ((pick -= options->load_density) < options->store_density) {
+			outputString(out, "STUR ");
+			outputRegister(out, rn);
+			outputString(out, ", [SP, #");
+			outputUnsigned(out, offset, 0);
+			outputWrite(out, "]", 1);
+		} else if (nextRandom(&state) % 4 == 0) {
+			outputString(out, "ADDI ");
+			outputRegister(out, rd);
+			outputString(out, ", ");
+			outputRegister(out, rn);
+			outputString(out, ", #");
+			outputUnsigned(out, nextRandom(&state) % 4096, 0);
+		} else {
+			outputString(out, alu_ops[nextRandom(&state) % 5]);
+			outputWrite(out, " ", 1);
+			outputRegister(out, rd);
+			outputString(out, ", ");
+			outputRegister(out, rn);
+			outputString(out, ", ");
+			outputRegister(out, rm);
+		}
+		outputWrite(out, "\n", 1);
+	}
+}
+
+// }}}
+
+// {{{ Benchmark
+
+static double secondsSince(const struct timespec *start) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)(now.tv_sec - start->tv_sec) +
+		   (double)(now.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+static void reportThroughput(const char *phase, uint64_t items,
+							 const char *unit, double seconds) {
+	printf("%-9s %12llu %-13s %9.3f s %10.2f M%s/s\n", phase,
+		   (unsigned long long)items, unit, seconds,
+		   seconds > 0 ? (double)items / seconds * 1e-6 : 0.0, unit);
+}
+
+// Times parsing, analysis and chart rendering of one program. The chart is
+// rendered to /dev/null so only formatting and buffering are measured.
+int runBenchmark(const char *path, unsigned int binary,
+				 const PipelineConfig *config, unsigned int execute,
+				 uint64_t max_steps, unsigned int threads,
+				 const ChartOptions *chart_options) {
+	Inputs inputs = {0};
+	Analysis analysis = {0};
+	struct timespec start;
+	struct stat st;
+	FILE *sink;
+
+	if (stat(path, &st) != 0) {
+		errorf("Could not open %s\n", path);
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (loadInputs(&inputs, path, binary, 0) != 0)
+		return 1;
+	double parse = secondsSince(&start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	runAnalysis(&analysis, &inputs, config, execute, max_steps, threads, 1,
+				NULL);
+	double analyze = secondsSince(&start);
+
+	if ((sink = fopen("/dev/null", "w")) == NULL) {
+		errorf("Could not open /dev/null\n");
+		return 1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	printChart(&analysis, chart_options, sink);
+	double chart = secondsSince(&start);
+	fclose(sink);
+
+	printf("\033[1mBenchmark: %s\033[0m\n", path);
+	reportThroughput("Parse", (uint64_t)inputs.instructions_count,
+					 "instructions", parse);
+	reportThroughput("Parse", (uint64_t)st.st_size, "bytes", parse);
+	reportThroughput("Analysis", analysis.instructions_count, "instructions",
+					 analyze);
+	reportThroughput("Chart", analysis.instructions_count, "rows", chart);
+
+	analysisFree(&analysis);
+	arenaFree(&inputs.arena);
+	return 0;
+}
+
+// }}}
+
+/*
+ *  Batch
+ */
+
+// {{{ Batch Jobs
 
-		for (int u = 0; u < i + stalls; u++)
-			printf("     ");
-		printf("|IF  |ID  |EX  |ME  |WB  |\n");
-		Instruction prev = ins.instructions[i];
-		Instruction next = ins.instructions[i + 1];
+// One program of a batch. Each job's result is written by the one worker
+// that ran it, so results need no locking.
+typedef struct {
+	const char *path;
+	int failed;
+	uint64_t instructions;
+	uint64_t stalls;
+	uint64_t cycles;
+} BatchJob;
+
+typedef struct {
+	BatchJob *jobs;
+	uint32_t count, capacity;
+	Arena arena;
+} BatchList;
+
+static void batchAdd(BatchList *list, const char *dir, const char *name,
+					 size_t length) {
+	size_t prefix = dir != NULL ? strlen(dir) + 1 : 0;
+	char *path = arenaAlloc(&list->arena, prefix + length + 1);
+
+	if (dir != NULL) {
+		memcpy(path, dir, prefix - 1);
+		path[prefix - 1] = '/';
+	}
+	memcpy(path + prefix, name, length);
+	path[prefix + length] = '\0';
+
+	if (list->count == list->capacity) {
+		list->capacity = list->capacity != 0 ? list->capacity * 2 : 64;
+		list->jobs = realloc(list->jobs, list->capacity * sizeof(BatchJob));
+	}
+	list->jobs[list->count++] = (BatchJob){.path = path};
+}
+
+static int compareJobs(const void *a, const void *b) {
+	return strcmp(((const BatchJob *)a)->path, ((const BatchJob *)b)->path);
+}
+
+// Every .s and .bin file of a directory, in name order
+static int listDirectory(BatchList *list, const char *dir) {
+	DIR *handle = opendir(dir);
+	struct dirent *entry;
+
+	if (handle == NULL) {
+		errorf("Could not open %s\n", dir);
+		return -1;
+	}
+
+	while ((entry = readdir(handle)) != NULL) {
+		size_t length = strlen(entry->d_name);
+
+		if ((length > 2 && strcmp(entry->d_name + length - 2, ".s") == 0) ||
+			(length > 4 && strcmp(entry->d_name + length - 4, ".bin") == 0))
+			batchAdd(list, dir, entry->d_name, length);
+	}
+	closedir(handle);
+
+	qsort(list->jobs, list->count, sizeof(BatchJob), compareJobs);
+	return 0;
+}
+
+// A manifest names one program per line; `//` starts a comment and relative
+// paths are taken from the manifest's directory
+static int listManifest(BatchList *list, const char *path) {
+	size_t len = 0;
+	int mapped = 0;
+	char *data = readSource(path, &len, &mapped);
+
+	if (data == NULL)
+		return len == 0 && mapped ? 0 : -1;
+
+	const char *slash = strrchr(path, '/');
+	char *dir = NULL;
+	if (slash != NULL)
+		dir = arenaStrndup(&list->arena, path, (size_t)(slash - path));
+
+	const char *p = data;
+	const char *end = data + len;
 
-		if (isLoad(prev)) {
-			char *loaded = prev.values.D.rt;
+	while (p < end) {
+		const char *eol = memchr(p, '\n', end - p);
+		if (eol == NULL)
+			eol = end;
 
-			if (instructionReadsRegister(next, loaded)) {
-				stalls++;
+		const char *stop = eol;
+		for (const char *c = p; c + 1 < stop; c++) {
+			if (c[0] == '/' && c[1] == '/') {
+				stop = c;
+				break;
 			}
 		}
+		while (p < stop && isspace((unsigned char)*p))
+			p++;
+		while (stop > p && isspace((unsigned char)stop[-1]))
+			stop--;
+
+		if (stop > p)
+			batchAdd(list, *p == '/' ? NULL : dir, p, (size_t)(stop - p));
+		p = eol + 1;
+	}
+
+	if (mapped)
+		munmap(data, len);
+	else
+		free(data);
+	return 0;
+}
+
+// }}}
+
+// {{{ Work-Stealing Pool
+
+// Each worker owns a range of job indices packed into one word, next in the
+// high half and end in the low half. The owner takes jobs from the front;
+// a worker whose range is empty takes the back half of the largest range
+// left and carries on with that. Both are a single compare-and-swap, so no
+// worker ever waits for another, and the pool is done when every range is
+// empty. Workers only read the program tables, which main fills before any
+// thread starts, and each one has its own arena for the programs it parses.
+typedef struct BatchPool BatchPool;
+
+typedef struct {
+	BatchPool *pool;
+	unsigned index;
+	uint64_t range;
+} BatchWorker;
+
+struct BatchPool {
+	BatchJob *jobs;
+	BatchWorker *workers;
+	unsigned count;
+	unsigned int binary;
+	unsigned int execute;
+	uint64_t max_steps;
+	const PipelineConfig *config;
+};
+
+#define RANGE(next, end) ((uint64_t)(next) << 32 | (uint32_t)(end))
+#define RANGE_NEXT(range) ((uint32_t)((range) >> 32))
+#define RANGE_END(range) ((uint32_t)(range))
+
+// Takes the next job of `worker`; returns 0 when its range is empty
+static int takeJob(BatchWorker *worker, uint32_t *job) {
+	uint64_t range = __atomic_load_n(&worker->range, __ATOMIC_ACQUIRE);
+
+	while (RANGE_NEXT(range) < RANGE_END(range)) {
+		uint64_t taken = RANGE(RANGE_NEXT(range) + 1, RANGE_END(range));
+
+		if (__atomic_compare_exchange_n(&worker->range, &range, taken, 0,
+										__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			*job = RANGE_NEXT(range);
+			return 1;
+		}
 	}
-	printf("\033[0m\n");
+	return 0;
 }
 
-void printTotalCycleCount(Inputs ins) {
-	int stalls = 0;
-	for (int i = 0; i < ins.instructions_count; i++) {
+// Moves the back half of the largest other range to `thief`; returns 0 once
+// there is nothing left anywhere
+static int stealJobs(BatchWorker *thief) {
+	BatchPool *pool = thief->pool;
 
-		Instruction prev = ins.instructions[i];
-		Instruction next = ins.instructions[i + 1];
+	for (;;) {
+		BatchWorker *victim = NULL;
+		uint64_t range = 0;
+		uint32_t most = 0;
 
-		if (isLoad(prev)) {
-			char *loaded = prev.values.D.rt;
+		for (unsigned k = 0; k < pool->count; k++) {
+			uint64_t seen =
+				__atomic_load_n(&pool->workers[k].range, __ATOMIC_ACQUIRE);
+			uint32_t left = RANGE_END(seen) - RANGE_NEXT(seen);
 
-			if (instructionReadsRegister(next, loaded)) {
-				stalls++;
+			if (RANGE_NEXT(seen) < RANGE_END(seen) && left > most) {
+				victim = &pool->workers[k];
+				range = seen;
+				most = left;
 			}
 		}
+		if (victim == NULL)
+			return 0;
+
+		uint32_t split = RANGE_END(range) - (most + 1) / 2;
+		if (__atomic_compare_exchange_n(&victim->range, &range,
+										RANGE(RANGE_NEXT(range), split), 0,
+										__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			__atomic_store_n(&thief->range, RANGE(split, RANGE_END(range)),
+							 __ATOMIC_RELEASE);
+			return 1;
+		}
+	}
+}
+
+static void runJob(BatchPool *pool, BatchJob *job, Inputs *inputs) {
+	Analysis analysis = {0};
+
+	if (loadInputs(inputs, job->path, pool->binary, 0) != 0) {
+		job->failed = 1;
+		return;
+	}
+
+	runAnalysis(&analysis, inputs, pool->config, pool->execute,
+				pool->max_steps, 1, 0, NULL);
+	job->instructions = analysis.instructions_count;
+	job->stalls = analysis.stalls;
+	job->cycles = analysis.total_cycles;
+	analysisFree(&analysis);
+}
+
+static void *batchWorker(void *argument) {
+	BatchWorker *worker = argument;
+	Inputs inputs = {0};
+	uint32_t job;
+
+	do {
+		while (takeJob(worker, &job))
+			runJob(worker->pool, &worker->pool->jobs[job], &inputs);
+	} while (stealJobs(worker));
+
+	arenaFree(&inputs.arena);
+	return NULL;
+}
+
+// }}}
+
+// {{{ Batch Report
+
+// Analyses every program named by `path` (a directory or a manifest) on
+// `threads` workers and writes one row per program to `output`
+int runBatch(const char *path, unsigned int binary,
+			 const PipelineConfig *config, unsigned int execute,
+			 uint64_t max_steps, unsigned int threads, const char *output) {
+	BatchList list = {0};
+	struct stat st;
+	int failed = 0;
+
+	if (stat(path, &st) != 0) {
+		errorf("Could not open %s\n", path);
+		return 1;
+	}
+	if ((S_ISDIR(st.st_mode) ? listDirectory(&list, path)
+							 : listManifest(&list, path)) != 0)
+		return 1;
+
+	if (threads > list.count)
+		threads = list.count != 0 ? list.count : 1;
+
+	BatchPool pool = {
+		.jobs = list.jobs,
+		.workers = calloc(threads, sizeof(BatchWorker)),
+		.count = threads,
+		.binary = binary,
+		.execute = execute,
+		.max_steps = max_steps,
+		.config = config,
+	};
+	pthread_t handles[threads];
+	uint8_t started[threads];
+
+	for (unsigned k = 0; k < threads; k++) {
+		pool.workers[k].pool = &pool;
+		pool.workers[k].index = k;
+		pool.workers[k].range =
+			RANGE((uint64_t)list.count * k / threads,
+				  (uint64_t)list.count * (k + 1) / threads);
+	}
+
+	// A worker whose thread cannot be created leaves its jobs to the others
+	for (unsigned k = 1; k < threads; k++)
+		started[k] =
+			pthread_create(&handles[k], NULL, batchWorker, &pool.workers[k]) ==
+			0;
+	batchWorker(&pool.workers[0]);
+	for (unsigned k = 1; k < threads; k++)
+		if (started[k])
+			pthread_join(handles[k], NULL);
+
+	FILE *file = stdout;
+	if (output != NULL && (file = fopen(output, "w")) == NULL) {
+		errorf("Could not open %s\n", output);
+		file = stdout;
+	}
+
+	int width = 4;
+	for (uint32_t i = 0; i < list.count; i++)
+		if ((int)strlen(list.jobs[i].path) > width)
+			width = (int)strlen(list.jobs[i].path);
+
+	uint64_t instructions = 0, stalls = 0, cycles = 0;
+
+	fprintf(file, "%-*s %14s %12s %14s %8s\n", width, "File", "Instructions",
+			"Stalls", "Cycles", "CPI");
+	for (uint32_t i = 0; i < list.count; i++) {
+		const BatchJob *job = &list.jobs[i];
+
+		if (job->failed) {
+			fprintf(file, "%-*s %14s %12s %14s %8s\n", width, job->path, "-",
+					"-", "-", "failed");
+			failed++;
+			continue;
+		}
+		fprintf(file, "%-*s %14llu %12llu %14llu %8.3f\n", width, job->path,
+				(unsigned long long)job->instructions,
+				(unsigned long long)job->stalls,
+				(unsigned long long)job->cycles,
+				job->instructions != 0
+					? (double)job->cycles / (double)job->instructions
+					: 0.0);
+		instructions += job->instructions;
+		stalls += job->stalls;
+		cycles += job->cycles;
 	}
-	printf("\n\033[1m\033[32mTotal Cycle Count: %d\033[0m\n\n",
-		   4 + ins.instructions_count + stalls);
+	fprintf(file, "%-*s %14llu %12llu %14llu %8.3f\n", width, "Total",
+			(unsigned long long)instructions, (unsigned long long)stalls,
+			(unsigned long long)cycles,
+			instructions != 0 ? (double)cycles / (double)instructions : 0.0);
+
+	if (file != stdout)
+		fclose(file);
+	if (failed != 0)
+		errorf("%d of %u programs could not be read\n", failed, list.count);
+
+	free(pool.workers);
+	free(list.jobs);
+	arenaFree(&list.arena);
+	return failed != 0;
 }
 
 // }}}
@@ -680,9 +6413,91 @@ void printTotalCycleCount(Inputs ins) {
  *  Main
  */
 
+void printHelp(void) {
+	printf("\033[1mHelp:\033[0m\n");
+	printf("Format     -> <binary> [options]\n");
+	printf("----------------------------\n");
+	printf("Help       -> -h\n");
+	printf("Verbose    -> -v\n");
+	printf("File       -> -f <file> (- for stdin)\n");
+	printf("Binary     -> --binary (-f is machine code, implied by .bin)\n");
+	printf("Stream     -> --stream <file> (- for stdin, constant memory, "
+		   "totals and --export only)\n");
+	printf("Assemble   -> --assemble <file.bin> (with -f)\n");
+	printf("Schedule   -> --schedule <file.s> (reorder to hide load-use "
+		   "stalls, - for stdout)\n");
+	printf("Chart      -> -c (with -f)\n");
+	printf("Critical   -> --critical-path (dependency chain and ILP "
+		   "bound)\n");
+	printf("Window     -> --window <start:count> (chart only those rows)\n");
+	printf("Compact    -> --compact (chart IF cycles as numbers)\n");
+	printf("Forwarding -> --forwarding <full|ex-mem|mem-wb|none>\n");
+	printf("Register   -> --no-split-regfile (WB and ID in separate cycles)\n");
+	printf("Branches   -> --branch "
+		   "<ideal|stall|not-taken|btfn|1bit|2bit|gshare>\n");
+	printf("Penalty    -> --branch-penalty <cycles> (default 1)\n");
+	printf("Predictor  -> --predictor-bits <1-24> (table of 2^n entries)\n");
+	printf("Cache      -> --cache <size:ways:line> (e.g. 32K:4:64, with -x)\n");
+	printf("Replace    -> --replacement <lru|plru|random>\n");
+	printf("Writes     -> --write-through (default write-back, allocate)\n");
+	printf("Miss       -> --miss-latency <cycles> (default 10)\n");
+	printf("Width      -> --width <1-%d> (instructions issued per cycle)\n",
+		   MAX_ISSUE_WIDTH);
+	printf("Ports      -> --ports <alu:mem:branch> (per cycle, default "
+		   "8:2:1)\n");
+	printf("Groups     -> --groups (chart the issue group of each cycle)\n");
+	printf("Out of     -> --ooo (Tomasulo core, fetching --width a cycle)\n");
+	printf("  order    -> --rob <n> (default 64) --commit-width <n> "
+		   "(default 4)\n");
+	printf("              --rs <alu:mul:div:mem:branch> (default "
+		   "16:8:4:16:8)\n");
+	printf("Units      -> --units (multi-cycle MUL/DIV, off by default)\n");
+	printf("Latency    -> --latency <OP=cycles> (e.g. MUL=4, implies "
+		   "--units)\n");
+	printf("Pipelining -> --pipelined|--unpipelined "
+		   "<alu|mul|div|mem|branch>\n");
+	printf("Export     -> --export <csv|jsonl|chrome> [-o <file>]\n");
+	printf("Threads    -> -j <n> (0 for every core, listings only)\n");
+	printf("Execute    -> -x (analyze the executed instructions)\n");
+	printf("Steps      -> --max-steps <n> (default %llu)\n",
+		   (unsigned long long)DEFAULT_MAX_STEPS);
+	printf("Generate   -> --generate <n> [-o <file>] (random program)\n");
+	printf("Shape      -> --load-density <f> --store-density <f> "
+		   "--branch-ratio <f>\n");
+	printf("              --dependency-distance <1-15> --seed <n>\n");
+	printf("Benchmark  -> --bench -f <file> (parse, analysis and chart "
+		   "throughput)\n");
+	printf("Batch      -> --batch <dir|manifest> [-j <n>] [-o <file>] "
+		   "(summary table)\n");
+}
+
 int main(int argc, char **argv) {
-	Inputs inputs;
+	Inputs inputs = {0};
+	Analysis analysis = {0};
+	PipelineConfig config = PIPELINE_CONFIG_DEFAULT;
 	unsigned int log = 0;
+	const char *input_path = NULL;
+	unsigned int chart = 0;
+	unsigned int groups = 0;
+	unsigned int critical_path = 0;
+	ChartOptions chart_options = {0};
+	unsigned int execute = 0;
+	uint64_t max_steps = DEFAULT_MAX_STEPS;
+	ExportFormat export_format = EXPORT_NONE;
+	const char *export_path = NULL;
+	GeneratorOptions generator = GENERATOR_OPTIONS_DEFAULT;
+	unsigned int generate = 0;
+	unsigned int bench = 0;
+	unsigned int binary = 0;
+	const char *assemble_path = NULL;
+	const char *schedule_path = NULL;
+	const char *stream_path = NULL;
+	const char *batch_path = NULL;
+	unsigned int threads = 1;
+
+	initOpcodeLookup();
+	initDecoder();
+	initLexer();
 
 	// Read command arguments
 	if (argc > 1) {
@@ -690,11 +6505,176 @@ int main(int argc, char **argv) {
 			if (strcmp(argv[i], "-v") == 0) {
 				messagef("Running in verbose mode\n");
 				log = 1;
+			} else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+				input_path = argv[++i];
+			} else if (strcmp(argv[i], "--stream") == 0 && i + 1 < argc) {
+				stream_path = argv[++i];
+			} else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+				batch_path = argv[++i];
+			} else if (strcmp(argv[i], "--binary") == 0) {
+				binary = 1;
+			} else if (strcmp(argv[i], "--assemble") == 0 && i + 1 < argc) {
+				assemble_path = argv[++i];
+			} else if (strcmp(argv[i], "--schedule") == 0 && i + 1 < argc) {
+				schedule_path = argv[++i];
+			} else if (strcmp(argv[i], "-c") == 0) {
+				chart = 1;
+			} else if (strcmp(argv[i], "--window") == 0 && i + 1 < argc) {
+				if (parseChartWindow(&chart_options, argv[++i]) != 0) {
+					errorf("Window must be start:count\n");
+					return 1;
+				}
+				chart = 1;
+			} else if (strcmp(argv[i], "--compact") == 0) {
+				chart_options.compact = 1;
+				chart = 1;
+			} else if (strcmp(argv[i], "--export") == 0 && i + 1 < argc) {
+				int format = parseExportFormat(argv[++i]);
+				if (format < 0) {
+					errorf("Unknown export format - %s\n", argv[i]);
+					return 1;
+				}
+				export_format = (ExportFormat)format;
+			} else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+				export_path = argv[++i];
+			} else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+				long count = strtol(argv[++i], NULL, 0);
+				if (count <= 0)
+					count = sysconf(_SC_NPROCESSORS_ONLN);
+				threads = count > 0 ? (unsigned int)count : 1;
+			} else if (strcmp(argv[i], "-x") == 0) {
+				execute = 1;
+			} else if (strcmp(argv[i], "--max-steps") == 0 && i + 1 < argc) {
+				max_steps = strtoull(argv[++i], NULL, 0);
+			} else if (strcmp(argv[i], "--forwarding") == 0 && i + 1 < argc) {
+				if (setForwarding(&config, argv[++i]) != 0) {
+					errorf("Unknown forwarding mode - %s\n", argv[i]);
+					return 1;
+				}
+			} else if (strcmp(argv[i], "--no-split-regfile") == 0) {
+				config.split_register_file = 0;
+			} else if (strcmp(argv[i], "--branch") == 0 && i + 1 < argc) {
+				if (setBranchPolicy(&config, argv[++i]) != 0) {
+					errorf("Unknown branch policy - %s\n", argv[i]);
+					return 1;
+				}
+			} else if (strcmp(argv[i], "--branch-penalty") == 0 &&
+					   i + 1 < argc) {
+				config.mispredict_penalty = (uint8_t)atoi(argv[++i]);
+			} else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+				if (setCacheGeometry(&config, argv[++i]) != 0) {
+					errorf("Cache must be size:ways:line in powers of two\n");
+					return 1;
+				}
+			} else if (strcmp(argv[i], "--replacement") == 0 &&
+					   i + 1 < argc) {
+				if (setReplacementPolicy(&config, argv[++i]) != 0) {
+					errorf("Unknown replacement policy - %s\n", argv[i]);
+					return 1;
+				}
+			} else if (strcmp(argv[i], "--write-through") == 0) {
+				config.cache.write_back = 0;
+			} else if (strcmp(argv[i], "--miss-latency") == 0 &&
+					   i + 1 < argc) {
+				config.cache.miss_latency = (uint16_t)atoi(argv[++i]);
+			} else if (strcmp(argv[i], "--width") == 0 && i + 1 < argc) {
+				int width = atoi(argv[++i]);
+				if (width < 1 || width > MAX_ISSUE_WIDTH) {
+					errorf("Issue width must be between 1 and %d\n",
+						   MAX_ISSUE_WIDTH);
+					return 1;
+				}
+				config.issue_width = (uint8_t)width;
+			} else if (strcmp(argv[i], "--ports") == 0 && i + 1 < argc) {
+				if (setIssuePorts(&config, argv[++i]) != 0) {
+					errorf("Ports must be alu:mem:branch, each 1-%d\n",
+						   MAX_ISSUE_WIDTH);
+					return 1;
+				}
+			} else if (strcmp(argv[i], "--ooo") == 0) {
+				config.out_of_order = 1;
+			} else if (strcmp(argv[i], "--rob") == 0 && i + 1 < argc) {
+				int size = atoi(argv[++i]);
+				if (size < 1 || size > MAX_ROB_SIZE) {
+					errorf("ROB size must be between 1 and %d\n",
+						   MAX_ROB_SIZE);
+					return 1;
+				}
+				config.rob_size = (uint16_t)size;
+				config.out_of_order = 1;
+			} else if (strcmp(argv[i], "--rs") == 0 && i + 1 < argc) {
+				if (setReservationStations(&config, argv[++i]) != 0) {
+					errorf("Stations must be alu:mul:div:mem:branch, each "
+						   "1-%d\n",
+						   MAX_STATIONS);
+					return 1;
+				}
+				config.out_of_order = 1;
+			} else if (strcmp(argv[i], "--commit-width") == 0 &&
+					   i + 1 < argc) {
+				int width = atoi(argv[++i]);
+				if (width < 1 || width > MAX_ISSUE_WIDTH) {
+					errorf("Commit width must be between 1 and %d\n",
+						   MAX_ISSUE_WIDTH);
+					return 1;
+				}
+				config.commit_width = (uint8_t)width;
+				config.out_of_order = 1;
+			} else if (strcmp(argv[i], "--critical-path") == 0) {
+				critical_path = 1;
+			} else if (strcmp(argv[i], "--groups") == 0) {
+				groups = 1;
+			} else if (strcmp(argv[i], "--units") == 0) {
+				config.functional_units = 1;
+			} else if (strcmp(argv[i], "--latency") == 0 && i + 1 < argc) {
+				if (setOpcodeLatency(&config, argv[++i]) != 0) {
+					errorf("Latency must be OP=cycles (1-255) - %s\n",
+						   argv[i]);
+					return 1;
+				}
+			} else if ((strcmp(argv[i], "--pipelined") == 0 ||
+						strcmp(argv[i], "--unpipelined") == 0) &&
+					   i + 1 < argc) {
+				int pipelined = argv[i][2] == 'p';
+				if (setUnitPipelined(&config, argv[++i], pipelined) != 0) {
+					errorf("Unknown functional unit - %s\n", argv[i]);
+					return 1;
+				}
+			} else if (strcmp(argv[i], "--predictor-bits") == 0 &&
+					   i + 1 < argc) {
+				int bits = atoi(argv[++i]);
+				if (bits < 1 || bits > 24) {
+					errorf("Predictor bits must be between 1 and 24\n");
+					return 1;
+				}
+				config.predictor_bits = (uint8_t)bits;
+			} else if (strcmp(argv[i], "--generate") == 0 && i + 1 < argc) {
+				generator.size = strtoull(argv[++i], NULL, 0);
+				generate = 1;
+			} else if (strcmp(argv[i], "--load-density") == 0 &&
+					   i + 1 < argc) {
+				generator.load_density = atof(argv[++i]);
+			} else if (strcmp(argv[i], "--store-density") == 0 &&
+					   i + 1 < argc) {
+				generator.store_density = atof(argv[++i]);
+			} else if (strcmp(argv[i], "--branch-ratio") == 0 &&
+					   i + 1 < argc) {
+				generator.branch_ratio = atof(argv[++i]);
+			} else if (strcmp(argv[i], "--dependency-distance") == 0 &&
+					   i + 1 < argc) {
+				int distance = atoi(argv[++i]);
+				if (distance < 1 || distance >= GENERATOR_REGISTERS) {
+					errorf("Dependency distance must be between 1 and %d\n",
+						   GENERATOR_REGISTERS - 1);
+					return 1;
+				}
+				generator.dependency_distance = (uint32_t)distance;
+			} else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+				generator.seed = strtoull(argv[++i], NULL, 0);
+			} else if (strcmp(argv[i], "--bench") == 0) {
+				bench = 1;
 			} else if (strcmp(argv[i], "-h") == 0) {
-				printf(
-					"\033[1mHelp:\033[0m\nFormat   -> <binary> [-h,-v] "
-					"\n----------------------------\nHelp     -> -h\nVerbose  "
-					"-> -v");
+				printHelp();
 				return 0;
 			} else if (i > 0) {
 				printf("\033[31m\033[1mArgument [%s] is invalid, continuing "
@@ -704,6 +6684,145 @@ int main(int argc, char **argv) {
 		}
 	}
 
+	// Write a synthetic program instead of analysing one
+	if (generate) {
+		OutputBuffer out;
+		FILE *file = stdout;
+
+		if (export_path != NULL && (file = fopen(export_path, "w")) == NULL) {
+			errorf("Could not open %s\n", export_path);
+			return 1;
+		}
+		outputInit(&out, file);
+		generateProgram(&generator, &out);
+		outputFree(&out);
+		if (file != stdout)
+			fclose(file);
+		return 0;
+	}
+
+	if (bench) {
+		if (input_path == NULL) {
+			errorf("--bench needs a program, given with -f\n");
+			return 1;
+		}
+		// A full-width chart of a large program is quadratic in size
+		if (!chart)
+			chart_options.compact = 1;
+		return runBenchmark(input_path, binary, &config, execute, max_steps,
+							threads, &chart_options);
+	}
+
+	if (batch_path != NULL)
+		return runBatch(batch_path, binary, &config, execute, max_steps,
+						threads, export_path);
+
+	// A stream is never held, so only the totals and an export are possible
+	if (stream_path != NULL) {
+		TimelineExporter exporter;
+		FILE *export_file = stdout;
+
+		if (execute || chart || groups || critical_path ||
+			schedule_path != NULL || assemble_path != NULL) {
+			errorf("--stream only reports totals and --export, it never "
+				   "holds the whole program\n");
+			return 1;
+		}
+		if (config.cache.size != 0)
+			errorf("The data cache needs addresses, only -x simulates it\n");
+
+		if (export_format != EXPORT_NONE) {
+			if (export_path != NULL &&
+				(export_file = fopen(export_path, "w")) == NULL) {
+				errorf("Could not open %s\n", export_path);
+				return 1;
+			}
+			exporterBegin(&exporter, export_format, export_file);
+		}
+
+		int failed = analyzeStream(
+			&analysis, stream_path, binary, &config, log,
+			export_format != EXPORT_NONE ? &exporter : NULL);
+
+		if (export_format != EXPORT_NONE) {
+			exporterEnd(&exporter);
+			if (export_file != stdout)
+				fclose(export_file);
+		}
+		if (failed == 0 &&
+			(export_format == EXPORT_NONE || export_file != stdout))
+			printTotalCycleCount(&analysis);
+		return failed == 0 ? 0 : 1;
+	}
+
+	// Non-interactive file mode
+	if (input_path != NULL) {
+		if (loadInputs(&inputs, input_path, binary, log) != 0)
+			return 1;
+
+		// Everything after this works on the scheduled program
+		if (schedule_path != NULL &&
+			runSchedule(&inputs, &config, execute, max_steps, threads,
+						schedule_path) != 0)
+			return 1;
+
+		if (assemble_path != NULL) {
+			FILE *file = fopen(assemble_path, "wb");
+			if (file == NULL) {
+				errorf("Could not open %s\n", assemble_path);
+				return 1;
+			}
+			int failed = assembleProgram(&inputs, file);
+			fclose(file);
+			arenaFree(&inputs.arena);
+			return failed == 0 ? 0 : 1;
+		}
+
+		TimelineExporter exporter;
+		FILE *export_file = stdout;
+
+		if (export_format != EXPORT_NONE) {
+			if (export_path != NULL &&
+				(export_file = fopen(export_path, "w")) == NULL) {
+				errorf("Could not open %s\n", export_path);
+				return 1;
+			}
+			exporterBegin(&exporter, export_format, export_file);
+		}
+
+		runAnalysis(&analysis, &inputs, &config, execute, max_steps, threads,
+					chart || groups,
+					export_format != EXPORT_NONE ? &exporter : NULL);
+
+		if (export_format != EXPORT_NONE) {
+			exporterEnd(&exporter);
+			if (export_file != stdout)
+				fclose(export_file);
+		}
+
+		// An export written to stdout is the whole output
+		if (export_format == EXPORT_NONE || export_file != stdout) {
+			if (chart == 1)
+				printChart(&analysis, &chart_options, stdout);
+			if (groups)
+				printIssueGroups(&analysis, &inputs, &chart_options, stdout);
+			printTotalCycleCount(&analysis);
+
+			if (critical_path) {
+				CriticalPath result;
+
+				analyzeCriticalPath(&result, &inputs, &config, execute,
+									max_steps);
+				printCriticalPath(&result, &inputs, &analysis);
+				criticalPathFree(&result);
+			}
+		}
+
+		analysisFree(&analysis);
+		arenaFree(&inputs.arena);
+		return 0;
+	}
+
 	// Main loop
 	while (1) {
 		printf("\033[1mPerformance Assessment\033[0m\n");
@@ -714,7 +6833,10 @@ int main(int argc, char **argv) {
 			"instructions\n");
 		printf(
 			"\033[1m3 ->\033[0m Print the total cycle count for the program\n");
-		printf("\033[31m\033[1m4 -> Quit\033[0m\n");
+		printf("\033[1m4 ->\033[0m Configure the pipeline\n");
+		printf("\033[1m5 ->\033[0m Run the program and analyze the executed "
+			   "instructions\n");
+		printf("\033[31m\033[1m6 -> Quit\033[0m\n");
 
 		unsigned int choice;
 		printf("\n\033[1mEnter selection: \033[0m");
@@ -723,25 +6845,53 @@ int main(int argc, char **argv) {
 		if (scanf_return == 1) {
 			switch (choice) {
 			case 1:
+				analysisFree(&analysis);
 				getUserInputs(&inputs, log);
+				execute = 0;
 				break;
 			case 2:
-				printChart(inputs);
+				if (!analysis.valid)
+					runAnalysis(&analysis, &inputs, &config, execute,
+								max_steps, threads, 1, NULL);
+				printChart(&analysis, &chart_options, stdout);
 				break;
 			case 3:
-				printTotalCycleCount(inputs);
+				if (!analysis.valid)
+					runAnalysis(&analysis, &inputs, &config, execute,
+								max_steps, threads, 1, NULL);
+				printTotalCycleCount(&analysis);
 				break;
 			case 4:
+				configurePipeline(&config);
+				analysis.valid = 0;
+				break;
+			case 5:
+				printf("\n\033[1mStep limit (currently %llu): \033[0m",
+					   (unsigned long long)max_steps);
+				if (scanf("%llu", (unsigned long long *)&max_steps) != 1) {
+					errorf("Not a valid step limit\n");
+					while (getchar() != '\n') {
+					}
+					break;
+				}
+				execute = 1;
+				runAnalysis(&analysis, &inputs, &config, execute, max_steps,
+							threads, 1, NULL);
+				printTotalCycleCount(&analysis);
+				break;
+			case 6:
+				analysisFree(&analysis);
+				arenaFree(&inputs.arena);
 				return 0;
 				break;
 			default:
 				errorf("Not a valid choice\n");
-				messagef("Accepted Input: 1, 2, 3, 4\n\n");
+				messagef("Accepted Input: 1, 2, 3, 4, 5, 6\n\n");
 				break;
 			}
 		} else if (scanf_return == 0) {
 			errorf("Input not an integer\n");
-			messagef("Accepted Input: 1, 2, 3, 4\n\n");
+			messagef("Accepted Input: 1, 2, 3, 4, 5, 6\n\n");
 			while (getchar() != '\n') {
 			}
 		} else if (scanf_return == EOF) {